@@ -0,0 +1,70 @@
+// Reference implementations of the CMSIS-DSP kernels in arm_math.h, with
+// the rounding and saturation of the library's generic C versions
+
+#include <stdint.h>
+#include <math.h>
+#include "arm_math.h"
+
+void arm_scale_q31(const q31_t *pSrc, q31_t scaleFract, int8_t shift, q31_t *pDst, uint32_t blockSize) {
+	
+	int			kShift = shift + 1;
+	q31_t		in, out;
+	
+	while(blockSize-- > 0) {
+		in = (q31_t)(((q63_t)*pSrc++ * scaleFract) >> 32);
+		out = (q31_t)((uint32_t)in << kShift);
+		if(in != (out >> kShift))
+			out = 0x7fffffff ^ (in >> 31);
+		*pDst++ = out;
+	}
+}
+
+void arm_power_q31(const q31_t *pSrc, uint32_t blockSize, q63_t *pResult) {
+	
+	q63_t		sum = 0;
+	
+	while(blockSize-- > 0) {
+		sum += ((q63_t)*pSrc * *pSrc) >> 14;
+		pSrc++;
+	}
+	
+	*pResult = sum;
+}
+
+void arm_abs_q31(const q31_t *pSrc, q31_t *pDst, uint32_t blockSize) {
+	
+	while(blockSize-- > 0) {
+		*pDst++ = *pSrc > 0 ? *pSrc : __QSUB(0, *pSrc);
+		pSrc++;
+	}
+}
+
+void arm_max_q31(const q31_t *pSrc, uint32_t blockSize, q31_t *pResult, uint32_t *pIndex) {
+	
+	uint32_t	i, idx = 0;
+	q31_t		max = pSrc[0];
+	
+	for(i = 1; i < blockSize; ++i)
+		if(pSrc[i] > max) {
+			max = pSrc[i];
+			idx = i;
+		}
+	
+	*pResult = max;
+	*pIndex = idx;
+}
+
+arm_status arm_sqrt_q31(q31_t in, q31_t *pOut) {
+	
+	double		r;
+	
+	if(in <= 0) {
+		*pOut = 0;
+		return in < 0 ? ARM_MATH_ARGUMENT_ERROR : ARM_MATH_SUCCESS;
+	}
+	
+	r = floor(sqrt(in / 2147483648.0) * 2147483648.0);
+	*pOut = r > 2147483647.0 ? 0x7fffffff : (q31_t)r;
+	
+	return ARM_MATH_SUCCESS;
+}
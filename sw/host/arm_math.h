@@ -0,0 +1,27 @@
+#ifndef ARM_MATH_H
+#define	ARM_MATH_H
+
+// The part of CMSIS-DSP that the streaming core uses, for the host build.
+// arm_math.c has reference implementations with the fixed point behaviour
+// of the library.
+
+#include <stdint.h>
+#include "cmsis_host.h"
+
+typedef int32_t		q31_t;
+typedef int16_t		q15_t;
+typedef int64_t		q63_t;
+typedef float		float32_t;
+
+typedef enum {
+	ARM_MATH_SUCCESS = 0,
+	ARM_MATH_ARGUMENT_ERROR = -1,
+} arm_status;
+
+void arm_scale_q31(const q31_t *pSrc, q31_t scaleFract, int8_t shift, q31_t *pDst, uint32_t blockSize);
+void arm_power_q31(const q31_t *pSrc, uint32_t blockSize, q63_t *pResult);
+void arm_abs_q31(const q31_t *pSrc, q31_t *pDst, uint32_t blockSize);
+void arm_max_q31(const q31_t *pSrc, uint32_t blockSize, q31_t *pResult, uint32_t *pIndex);
+arm_status arm_sqrt_q31(q31_t in, q31_t *pOut);
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef HOST_AUDIO_HAL_H_
+#define	HOST_AUDIO_HAL_H_
+
+// Simulated I2S DMA for the host build of audio_ring.c, included from
+// src/audio_hal.h. sim.c moves the DMA position and sets the state that
+// the DMA and I2S would.
+
+extern volatile int		simRemaining;	// NDTR
+extern volatile int		simTarget;		// CT bit in double buffer mode
+extern volatile int		simStreaming;	// DMA enabled and I2S clocking out data
+
+static inline int AudioHalRemaining(void) {
+	
+	return simRemaining;
+}
+
+static inline int AudioHalTarget(void) {
+	
+	return simTarget;
+}
+
+static inline int AudioHalStreaming(void) {
+	
+	return simStreaming;
+}
+
+#endif
@@ -0,0 +1,47 @@
+// Streaming benchmark: median time per packet in the ingest path, mean
+// DMA interrupt work per ms, buffer fill and feedback convergence for
+// every format and rate. Times are for the host CPU; they compare code
+// paths, not the target.
+
+#include <stdint.h>
+#include <stdio.h>
+#include "arm_math.h"
+#include "audio.h"
+#include "sim.h"
+
+#define RUN_MS	10000
+
+static const struct {
+	int		bits, fs;
+} formats[] = {
+	{24, 44100}, {24, 48000}, {24, 88200}, {24, 96000},
+	{16, 44100}, {16, 48000}, {16, 88200}, {16, 96000}, {16, 176400},
+	{32, 44100}, {32, 48000},
+};
+
+static const int	volumes[] = {0, -6 * 256};
+
+int main(void) {
+	
+	struct sim_stream	s = {0};
+	struct sim_stats	st;
+	unsigned			i, v;
+	
+	printf("%-4s %-7s %-6s %10s %9s %10s %8s %9s %8s\n", "bits", "fs", "volume", "ns/packet", "ns/ms DMA",
+		   "fill", "fill sd", "settle", "fb ppm");
+	
+	s.ms = RUN_MS;
+	s.ppm = 100;
+	for(v = 0; v < sizeof(volumes) / sizeof(volumes[0]); ++v)
+		for(i = 0; i < sizeof(formats) / sizeof(formats[0]); ++i) {
+			s.bits = formats[i].bits;
+			s.fs = formats[i].fs;
+			s.volume = volumes[v];
+			SimRun(&s, &st);
+			printf("%-4d %-7d %-6d %10.0f %9.0f %4d..%-4d %8.2f %6d ms %+8.2f%s\n", s.bits, s.fs, s.volume / 256,
+				   st.nsPacket, st.nsDMA, st.fillMin, st.fillMax, st.fillSd, st.settleMs, st.fbPpm,
+				   (st.underruns || st.overruns) ? " xrun" : "");
+		}
+	
+	return 0;
+}
@@ -0,0 +1,35 @@
+// Convergence of the rate feedback loop in fbsim.c for every rate, with the
+// device clock off against the host. The fill error is in halfwords at
+// SOF, over the last second of the run.
+//
+// bench_fb fs ppm writes the fill error and feedback of every frame of
+// one run instead, for plotting: frame, fill error, feedback in Hz.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "fbsim.h"
+
+#define RUN_MS	10000
+
+static const int	rates[] = {44100, 48000, 88200, 96000, 176400};
+static const int	ppms[] = {-200, 0, 200};
+
+int main(int argc, char **argv) {
+	
+	struct fb_stats	st;
+	unsigned		i, p;
+	
+	if(argc == 3)
+		return !FbSimRun(atoi(argv[1]), atoi(argv[2]), RUN_MS, &st, stdout);
+	
+	printf("%-7s %5s %9s %10s %9s %8s %8s\n", "fs", "ppm", "settle", "fill", "fill mean", "fill sd", "fb ppm");
+	for(i = 0; i < sizeof(rates) / sizeof(rates[0]); ++i)
+		for(p = 0; p < sizeof(ppms) / sizeof(ppms[0]); ++p) {
+			FbSimRun(rates[i], ppms[p], RUN_MS, &st, NULL);
+			printf("%-7d %+5d %6d ms %4d..%-4d %9.2f %8.2f %+8.2f\n", rates[i], ppms[p], st.settleMs, st.fillMin,
+				   st.fillMax, st.fillMean, st.fillSd, st.fbPpm);
+		}
+	
+	return 0;
+}
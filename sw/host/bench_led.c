@@ -0,0 +1,320 @@
+// GPIO register accesses per LED ramp interrupt, TIM4_IRQHandler in
+// ledRamp.c against the handler before the ramp was driven from BSRR
+// tables: an if/else ladder over the thresholds and one read-modify-write
+// of BSRR per LED. Both are built with -fsanitize=thread, whose access
+// hooks periph.c counts. On the target each of these is an AHB1
+// transaction. The analog meter build, without DIGITAL_METER, is counted.
+
+#include <stdint.h>
+#include <stdio.h>
+#include "stm32f4xx.h"
+#include "adc.h"
+#include "ledRamp.h"
+
+#define NVALS	1024
+
+#define	TIMEOUT		100
+
+void TIM4_IRQHandler(void);
+
+extern int		thresholds[];
+
+static int		vals[NVALS], next;
+static int		oldChannel, oldPeak[2] = {-1, -1}, oldTimeout[2];
+
+// Input of both handlers, the levels in vals in turn
+int ADCRead(__attribute__((unused)) int ch) {
+	
+	next = (next + 1) % NVALS;
+	
+	return vals[next];
+}
+
+// setLEDRampVal and setLEDPeakVal before the change
+static int oldRampVal(int val) {
+	
+	int		level;
+	
+	if(val > thresholds[9]) {
+		GPIOA->BSRR |= GPIO_BSRR_BS2;
+		GPIOA->BSRR |= GPIO_BSRR_BS3;
+		GPIOA->BSRR |= GPIO_BSRR_BS7;
+		GPIOA->BSRR |= GPIO_BSRR_BS8;
+		GPIOA->BSRR |= GPIO_BSRR_BS10;
+		GPIOB->BSRR |= GPIO_BSRR_BS7;
+		GPIOB->BSRR |= GPIO_BSRR_BS8;
+		GPIOB->BSRR |= GPIO_BSRR_BS9;
+		GPIOB->BSRR |= GPIO_BSRR_BS10;
+		GPIOC->BSRR |= GPIO_BSRR_BS14;
+		level = 9;
+	}
+	else if(val > thresholds[8]) {
+		GPIOA->BSRR |= GPIO_BSRR_BS2;
+		GPIOA->BSRR |= GPIO_BSRR_BS3;
+		GPIOA->BSRR |= GPIO_BSRR_BS7;
+		GPIOA->BSRR |= GPIO_BSRR_BS8;
+		GPIOA->BSRR |= GPIO_BSRR_BS10;
+		GPIOB->BSRR |= GPIO_BSRR_BS7;
+		GPIOB->BSRR |= GPIO_BSRR_BS8;
+		GPIOB->BSRR |= GPIO_BSRR_BS9;
+		GPIOB->BSRR |= GPIO_BSRR_BS10;
+		GPIOC->BSRR |= GPIO_BSRR_BR14;
+		level = 8;
+	}
+	else if(val > thresholds[7]) {
+		GPIOA->BSRR |= GPIO_BSRR_BS2;
+		GPIOA->BSRR |= GPIO_BSRR_BS3;
+		GPIOA->BSRR |= GPIO_BSRR_BS7;
+		GPIOA->BSRR |= GPIO_BSRR_BS8;
+		GPIOA->BSRR |= GPIO_BSRR_BS10;
+		GPIOB->BSRR |= GPIO_BSRR_BS7;
+		GPIOB->BSRR |= GPIO_BSRR_BS8;
+		GPIOB->BSRR |= GPIO_BSRR_BS9;
+		GPIOB->BSRR |= GPIO_BSRR_BR10;
+		GPIOC->BSRR |= GPIO_BSRR_BR14;
+		level = 7;
+	}
+	else if(val > thresholds[6]) {
+		GPIOA->BSRR |= GPIO_BSRR_BS2;
+		GPIOA->BSRR |= GPIO_BSRR_BS3;
+		GPIOA->BSRR |= GPIO_BSRR_BS7;
+		GPIOA->BSRR |= GPIO_BSRR_BS8;
+		GPIOA->BSRR |= GPIO_BSRR_BS10;
+		GPIOB->BSRR |= GPIO_BSRR_BS7;
+		GPIOB->BSRR |= GPIO_BSRR_BS8;
+		GPIOB->BSRR |= GPIO_BSRR_BR9;
+		GPIOB->BSRR |= GPIO_BSRR_BR10;
+		GPIOC->BSRR |= GPIO_BSRR_BR14;
+		level = 6;
+	}
+	else if(val > thresholds[5]) {
+		GPIOA->BSRR |= GPIO_BSRR_BS2;
+		GPIOA->BSRR |= GPIO_BSRR_BS3;
+		GPIOA->BSRR |= GPIO_BSRR_BS7;
+		GPIOA->BSRR |= GPIO_BSRR_BS8;
+		GPIOA->BSRR |= GPIO_BSRR_BS10;
+		GPIOB->BSRR |= GPIO_BSRR_BS7;
+		GPIOB->BSRR |= GPIO_BSRR_BR8;
+		GPIOB->BSRR |= GPIO_BSRR_BR9;
+		GPIOB->BSRR |= GPIO_BSRR_BR10;
+		GPIOC->BSRR |= GPIO_BSRR_BR14;
+		level = 5;
+	}
+	else if(val > thresholds[4]) {
+		GPIOA->BSRR |= GPIO_BSRR_BS2;
+		GPIOA->BSRR |= GPIO_BSRR_BS3;
+		GPIOA->BSRR |= GPIO_BSRR_BS7;
+		GPIOA->BSRR |= GPIO_BSRR_BS8;
+		GPIOA->BSRR |= GPIO_BSRR_BS10;
+		GPIOB->BSRR |= GPIO_BSRR_BR7;
+		GPIOB->BSRR |= GPIO_BSRR_BR8;
+		GPIOB->BSRR |= GPIO_BSRR_BR9;
+		GPIOB->BSRR |= GPIO_BSRR_BR10;
+		GPIOC->BSRR |= GPIO_BSRR_BR14;
+		level = 4;
+	}
+	else if(val > thresholds[3]) {
+		GPIOA->BSRR |= GPIO_BSRR_BS2;
+		GPIOA->BSRR |= GPIO_BSRR_BS3;
+		GPIOA->BSRR |= GPIO_BSRR_BS7;
+		GPIOA->BSRR |= GPIO_BSRR_BS8;
+		GPIOA->BSRR |= GPIO_BSRR_BR10;
+		GPIOB->BSRR |= GPIO_BSRR_BR7;
+		GPIOB->BSRR |= GPIO_BSRR_BR8;
+		GPIOB->BSRR |= GPIO_BSRR_BR9;
+		GPIOB->BSRR |= GPIO_BSRR_BR10;
+		GPIOC->BSRR |= GPIO_BSRR_BR14;
+		level = 3;
+	}
+	else if(val > thresholds[2]) {
+		GPIOA->BSRR |= GPIO_BSRR_BS2;
+		GPIOA->BSRR |= GPIO_BSRR_BS3;
+		GPIOA->BSRR |= GPIO_BSRR_BS7;
+		GPIOA->BSRR |= GPIO_BSRR_BR8;
+		GPIOA->BSRR |= GPIO_BSRR_BR10;
+		GPIOB->BSRR |= GPIO_BSRR_BR7;
+		GPIOB->BSRR |= GPIO_BSRR_BR8;
+		GPIOB->BSRR |= GPIO_BSRR_BR9;
+		GPIOB->BSRR |= GPIO_BSRR_BR10;
+		GPIOC->BSRR |= GPIO_BSRR_BR14;
+		level = 2;
+	}
+	else if(val > thresholds[1]) {
+		GPIOA->BSRR |= GPIO_BSRR_BS2;
+		GPIOA->BSRR |= GPIO_BSRR_BS3;
+		GPIOA->BSRR |= GPIO_BSRR_BR7;
+		GPIOA->BSRR |= GPIO_BSRR_BR8;
+		GPIOA->BSRR |= GPIO_BSRR_BR10;
+		GPIOB->BSRR |= GPIO_BSRR_BR7;
+		GPIOB->BSRR |= GPIO_BSRR_BR8;
+		GPIOB->BSRR |= GPIO_BSRR_BR9;
+		GPIOB->BSRR |= GPIO_BSRR_BR10;
+		GPIOC->BSRR |= GPIO_BSRR_BR14;
+		level = 1;
+	}
+	else if(val > thresholds[0]) {
+		GPIOA->BSRR |= GPIO_BSRR_BS2;
+		GPIOA->BSRR |= GPIO_BSRR_BR3;
+		GPIOA->BSRR |= GPIO_BSRR_BR7;
+		GPIOA->BSRR |= GPIO_BSRR_BR8;
+		GPIOA->BSRR |= GPIO_BSRR_BR10;
+		GPIOB->BSRR |= GPIO_BSRR_BR7;
+		GPIOB->BSRR |= GPIO_BSRR_BR8;
+		GPIOB->BSRR |= GPIO_BSRR_BR9;
+		GPIOB->BSRR |= GPIO_BSRR_BR10;
+		GPIOC->BSRR |= GPIO_BSRR_BR14;
+		level = 0;
+	}
+	else {
+		GPIOA->BSRR |= GPIO_BSRR_BR2;
+		GPIOA->BSRR |= GPIO_BSRR_BR3;
+		GPIOA->BSRR |= GPIO_BSRR_BR7;
+		GPIOA->BSRR |= GPIO_BSRR_BR8;
+		GPIOA->BSRR |= GPIO_BSRR_BR10;
+		GPIOB->BSRR |= GPIO_BSRR_BR7;
+		GPIOB->BSRR |= GPIO_BSRR_BR8;
+		GPIOB->BSRR |= GPIO_BSRR_BR9;
+		GPIOB->BSRR |= GPIO_BSRR_BR10;
+		GPIOC->BSRR |= GPIO_BSRR_BR14;
+		level = -1;
+	}
+	
+	return level;
+}
+
+static void oldPeakVal(int val) {
+	
+	switch(val) {
+		case 0:
+			GPIOA->BSRR |= GPIO_BSRR_BS2;
+			break;
+		case 1:
+			GPIOA->BSRR |= GPIO_BSRR_BS3;
+			break;
+		case 2:
+			GPIOA->BSRR |= GPIO_BSRR_BS7;
+			break;
+		case 3:
+			GPIOA->BSRR |= GPIO_BSRR_BS8;
+			break;
+		case 4:
+			GPIOA->BSRR |= GPIO_BSRR_BS10;
+			break;
+		case 5:
+			GPIOB->BSRR |= GPIO_BSRR_BS7;
+			break;
+		case 6:
+			GPIOB->BSRR |= GPIO_BSRR_BS8;
+			break;
+		case 7:
+			GPIOB->BSRR |= GPIO_BSRR_BS9;
+			break;
+		case 8:
+			GPIOB->BSRR |= GPIO_BSRR_BS10;
+			break;
+		case 9:
+			GPIOC->BSRR |= GPIO_BSRR_BS14;
+			break;
+	}
+}
+
+// TIM4_IRQHandler before the change, without the profiling
+static void oldTIM4(void) {
+	
+	int	val, level;
+	
+	oldChannel = (oldChannel + 1) % 2;
+	
+	val = ADCRead(oldChannel);
+	
+	level = oldRampVal(val);
+	
+	oldTimeout[oldChannel] += 1;
+	
+	if(level < oldPeak[oldChannel]) {
+		if(oldTimeout[oldChannel] < TIMEOUT)
+			oldPeakVal(oldPeak[oldChannel]);
+		else {
+			oldTimeout[oldChannel] = 0;
+			oldPeak[oldChannel] = -1;
+		}
+	}
+	else {
+		oldPeak[oldChannel] = level;
+		oldTimeout[oldChannel] = 0;
+	}
+	
+	if(oldChannel)
+		GPIOC->BSRR |= GPIO_BSRR_BR15;
+	else
+		GPIOC->BSRR |= GPIO_BSRR_BS15;
+	
+	if(TIM4->SR & TIM_SR_UIF)
+		TIM4->SR &= ~TIM_SR_UIF;
+}
+
+// Count the GPIO accesses of handler over NVALS interrupts, mean and most
+// per interrupt
+static void count(const char *name, const char *handlerName, void (*handler)(void)) {
+	
+	uint32_t	reads, writes, maxReads = 0, maxWrites = 0;
+	int			i;
+	
+	simGPIOReads = simGPIOWrites = 0;
+	for(i = 0; i < NVALS; ++i) {
+		reads = simGPIOReads;
+		writes = simGPIOWrites;
+		TIM4->SR = TIM_SR_UIF;
+		handler();
+		reads = simGPIOReads - reads;
+		writes = simGPIOWrites - writes;
+		maxReads = reads > maxReads ? reads : maxReads;
+		maxWrites = writes > maxWrites ? writes : maxWrites;
+	}
+	
+	printf("%-8s %-8s %8.2f %5u %8.2f %5u\n", name, handlerName, (double)simGPIOReads / NVALS, (unsigned)maxReads,
+		   (double)simGPIOWrites / NVALS, (unsigned)maxWrites);
+}
+
+// Both handlers on the levels from fill
+static void run(const char *name, void (*fill)(int *v)) {
+	
+	fill(vals);
+	count(name, "old", oldTIM4);
+	count(name, "new", TIM4_IRQHandler);
+}
+
+// Any level at each interrupt
+static void fillRandom(int *v) {
+	
+	int		i;
+	
+	for(i = 0; i < NVALS; ++i)
+		v[i] = (int)((i * 0x9e3779b9u) >> 20) % (thresholds[9] + 500);
+}
+
+// Up and down the ramp, like music
+static void fillSweep(int *v) {
+	
+	int		i;
+	
+	for(i = 0; i < NVALS; ++i)
+		v[i] = (i < NVALS / 2 ? i : NVALS - i) * 2 * (thresholds[9] + 500) / NVALS;
+}
+
+int main(void) {
+	
+#ifdef DIGITAL_METER
+	printf("bench_led: counts the build without DIGITAL_METER\n");
+	return 0;
+#endif
+	
+	LEDRampInit();
+	
+	printf("%-8s %-8s %14s %14s\n", "levels", "handler", "reads/irq", "writes/irq");
+	printf("%-8s %-8s %8s %5s %8s %5s\n", "", "", "mean", "max", "mean", "max");
+	run("random", fillRandom);
+	run("sweep", fillSweep);
+	
+	return 0;
+}
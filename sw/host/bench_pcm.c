@@ -0,0 +1,99 @@
+// Time per packet of the unpack kernels in pcm.c, at the highest rate of
+// each format and for 24 against 32 bit at 48 kHz, reading straight from
+// the USB FIFO, against the original path: the packet copied out of the
+// FIFO into tmpBuf as usbd_ep_read did, then unpacked byte-wise like
+// ept1_callback, without its modulo per halfword. The fastest of BATCHES
+// batches is shown, as host CPU times for comparing the paths.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "arm_math.h"
+#include "pcm.h"
+#include "audio.h"
+#include "ref.h"
+
+#define REPEAT	100000
+#define BATCHES	5
+
+struct kernel {
+	const char	*name;
+	int			bytes;		// Per frame
+	int			frames;		// Per packet
+	void		(*unpack)(uint16_t *dst, volatile uint32_t *src, int nFrames);
+	void		(*ref)(uint16_t *dst, const uint8_t *buf, int nFrames);
+};
+
+static const struct kernel	kernels[] = {
+	{"24 bit",	6,	SAMPLES96000,	PCMUnpack24,	RefUnpack24},
+	{"16 bit",	4,	SAMPLES176400,	PCMUnpack16,	RefUnpack16},
+	{"24 bit",	6,	SAMPLES48000,	PCMUnpack24,	RefUnpack24},
+	{"32 bit",	8,	SAMPLES48000,	PCMUnpack32,	RefUnpack32},
+};
+
+static uint32_t		packet[MAX_PACKET_FRAMES * 2 + 1];
+static uint8_t		tmpBuf[MAX_PACKET_FRAMES * 8];
+static uint16_t		out[4 * MAX_PACKET_FRAMES + 2] __attribute__((aligned(16)));
+
+static double now(void) {
+	
+	struct timespec	t;
+	
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	
+	return t.tv_sec * 1e9 + t.tv_nsec;
+}
+
+// The original path: the packet is read from the FIFO into tmpBuf, then
+// unpacked byte by byte
+static void oldPath(const struct kernel *k, uint16_t *dst) {
+	
+	int		i, words = (k->frames * k->bytes + 3) / 4;
+	
+	FifoLoad(packet);
+	for(i = 0; i < words; ++i)
+		((uint32_t *)tmpBuf)[i] = FifoRead(&usbFifo);
+	k->ref(dst, tmpBuf, k->frames);
+}
+
+int main(void) {
+	
+	unsigned	i;
+	int			r, b, align;
+	double		t, tOld, tNew;
+	const struct kernel	*k;
+	
+	for(i = 0; i < sizeof(packet) / 4; ++i)
+		packet[i] = i * 0x9e3779b9;
+	
+	printf("%-8s %6s %6s %12s %12s\n", "format", "frames", "offset", "old ns/pkt", "new ns/pkt");
+	for(i = 0; i < sizeof(kernels) / sizeof(kernels[0]); ++i)
+		for(align = 0; align < 2; ++align) {
+			k = &kernels[i];
+	
+			tOld = tNew = 1e9;
+			for(b = 0; b < BATCHES; ++b) {
+				t = now();
+				for(r = 0; r < REPEAT; ++r) {
+					oldPath(k, &out[align]);
+					__asm__ volatile("" ::: "memory");
+				}
+				t = (now() - t) / REPEAT;
+				tOld = t < tOld ? t : tOld;
+	
+				t = now();
+				for(r = 0; r < REPEAT; ++r) {
+					FifoLoad(packet);
+					k->unpack(&out[align], &usbFifo, k->frames);
+					__asm__ volatile("" ::: "memory");
+				}
+				t = (now() - t) / REPEAT;
+				tNew = t < tNew ? t : tNew;
+			}
+	
+			printf("%-8s %6d %6d %12.1f %12.1f\n", k->name, k->frames, align, tOld, tNew);
+		}
+	
+	return 0;
+}
@@ -0,0 +1,58 @@
+#ifndef CMSIS_HOST_H_
+#define	CMSIS_HOST_H_
+
+// Cortex-M4 core intrinsics for the host build, in plain C with the same
+// results as the CMSIS versions in cmsis_gcc.h. Interrupts do not exist on
+// the host, so masking them and the barriers only stop the compiler from
+// moving memory accesses.
+
+#include <stdint.h>
+
+#define __PKHBT(a, b, s)	((((uint32_t)(a)) & 0x0000ffff) | ((((uint32_t)(b)) << (s)) & 0xffff0000))
+#define __PKHTB(a, b, s)	((((uint32_t)(a)) & 0xffff0000) | ((((uint32_t)(b)) >> (s)) & 0x0000ffff))
+
+struct T_UINT32_WRITE {
+	uint32_t	v;
+} __attribute__((packed, aligned(1)));
+#define __UNALIGNED_UINT32_WRITE(addr, val)	(void)((((struct T_UINT32_WRITE *)(void *)(addr))->v) = (val))
+
+static inline uint32_t __ROR(uint32_t v, uint32_t n) {
+	
+	n &= 31;
+	
+	return n ? (v >> n) | (v << (32 - n)) : v;
+}
+
+static inline uint32_t __CLZ(uint32_t v) {
+	
+	return v ? __builtin_clz(v) : 32;
+}
+
+static inline int32_t __QSUB(int32_t a, int32_t b) {
+	
+	int64_t		d = (int64_t)a - b;
+	
+	return d > INT32_MAX ? INT32_MAX : (d < INT32_MIN ? INT32_MIN : (int32_t)d);
+}
+
+static inline void __DMB(void) {
+	
+	__asm__ volatile("" ::: "memory");
+}
+
+static inline void __DSB(void) {
+	
+	__asm__ volatile("" ::: "memory");
+}
+
+static inline void __disable_irq(void) {
+	
+	__asm__ volatile("" ::: "memory");
+}
+
+static inline void __enable_irq(void) {
+	
+	__asm__ volatile("" ::: "memory");
+}
+
+#endif
@@ -0,0 +1,106 @@
+// Host model of the rate feedback loop, see fbsim.h
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "audio.h"
+#include "feedback.h"
+#include "i2s_pll.h"
+#include "fbsim.h"
+
+// Run ms frames at fs. Writes the frame, fill error and feedback in Hz
+// to trace if given. Returns 0 if the sampling frequency is not supported.
+int FbSimRun(int fs, int ppm, int ms, struct fb_stats *st, FILE *trace) {
+	
+	const struct i2s_pll	*pll = 0;
+	FeedbackPI	pi;
+	unsigned	i;
+	double		fsDev, mclk = 0, dma = 0, sum = 0, sum2 = 0, fbSum = 0;
+	uint32_t	fbDefault, hostFb, hostAcc = 0, fbAcc = 0, fb;
+	int			t, n, ccr, fill, error, delta, target, sofNum = 0, nFb = 0, last, playing = 0;
+	
+	for(i = 0; i < sizeof(i2s_pll_table) / sizeof(i2s_pll_table[0]); ++i)
+		if(i2s_pll_table[i].fs == fs)
+			pll = &i2s_pll_table[i];
+	if(!pll || (ms < 1))
+		return 0;
+	
+	memset(st, 0, sizeof(*st));
+	st->fillMin = INT32_MAX;
+	st->fillMax = INT32_MIN;
+	FeedbackInit(&pi, fs, FB_LIMIT);
+	
+	// The host starts at the nominal rate, playback once the fill reaches the
+	// target
+	target = 4 * LATENCY_MS * ((fs + 999) / 1000);
+	fill = 0;
+	fbDefault = pll->fb;
+	fsDev = pll->fb * (1000.0 / 16384) * (1 + ppm * 1e-6);
+	hostFb = (uint32_t)((int64_t)fs * 16384 / 1000);
+	last = ms > 1000 ? ms - 1000 : 0;
+	
+	for(t = 0; t < ms; ++t) {
+		// TIM2 captures the MCLK count at each SOF
+		mclk += 256 * fsDev / 1000;
+		ccr = (int)mclk;
+		mclk -= ccr;
+	
+		// SOF, as event_sof
+		error = playing ? target - fill : 0;
+		delta = FeedbackUpdate(&pi, error);
+		if(++sofNum == 1 << FB_RATE) {
+			fb = (fbAcc + ccr) << 4; // 2^FB_RATE frames of MCLK = 256 fs, in 10.14
+			fb += delta;
+			if(fb > fbDefault + FB_LIMIT)
+				fb = fbDefault + FB_LIMIT;
+			if(fb < fbDefault - FB_LIMIT)
+				fb = fbDefault - FB_LIMIT;
+			hostFb = fb;
+			sofNum = 0;
+			fbAcc = 0;
+			if(t >= last) {
+				fbSum += fb * (1000.0 / 16384);
+				nFb++;
+			}
+		}
+		else
+			fbAcc += ccr;
+	
+		if(!playing || (abs(error) > SETTLE_TOL))
+			st->settleMs = t + 1;
+		if(t >= last) {
+			sum -= error;
+			sum2 += (double)error * error;
+			if(-error < st->fillMin)
+				st->fillMin = -error;
+			if(-error > st->fillMax)
+				st->fillMax = -error;
+		}
+		if(trace)
+			fprintf(trace, "%d %d %.3f\n", t, -error, hostFb * (1000.0 / 16384));
+	
+		// The host sends the frames its feedback accumulator has reached,
+		// and the I2S reads a millisecond of them
+		hostAcc += hostFb;
+		n = hostAcc >> 14;
+		hostAcc &= 0x3fff;
+		fill += 4 * n;
+		if(fill >= target)
+			playing = 1;
+		if(!playing)
+			continue;
+	
+		dma += 4 * fsDev / 1000;
+		n = (int)dma;
+		dma -= n;
+		fill -= n;
+	}
+	
+	n = ms - last;
+	st->fillMean = sum / n;
+	st->fillSd = sqrt(sum2 / n - st->fillMean * st->fillMean);
+	st->fbPpm = nFb ? (fbSum / nFb - fsDev) / fsDev * 1e6 : 0;
+	
+	return 1;
+}
@@ -0,0 +1,27 @@
+#ifndef FBSIM_H_
+#define	FBSIM_H_
+
+// Host model of the rate feedback loop. The host sends the frames that its
+// feedback accumulator reaches each 1 ms frame, the I2S consumes them at
+// the rate its PLL generates, offset by ppm to model the clock of the
+// host, and the fill error at each SOF runs the PI controller in
+// feedback.c as event_sof does. The ring buffer itself is not modelled,
+// only its fill level.
+
+#include <stdio.h>
+
+struct fb_stats {
+	int			settleMs;	// First frame after which the fill stays within SETTLE_TOL
+	int			fillMin;	// Fill at SOF relative to the target over the last second, halfwords
+	int			fillMax;
+	double		fillMean;
+	double		fillSd;
+	double		fbPpm;		// Mean feedback error over the last second
+};
+
+// Fill error that counts as settled, one stereo frame
+#define SETTLE_TOL	4
+
+int FbSimRun(int fs, int ppm, int ms, struct fb_stats *st, FILE *trace);
+
+#endif
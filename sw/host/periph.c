@@ -0,0 +1,51 @@
+// Registers of the simulated peripherals, see stm32f4xx.h
+
+#include <stdint.h>
+#include <stddef.h>
+#include "stm32f4xx.h"
+
+GPIO_TypeDef		simGPIOA, simGPIOB, simGPIOC;
+TIM_TypeDef			simTIM3, simTIM4, simTIM5;
+RCC_TypeDef			simRCC;
+EXTI_TypeDef		simEXTI;
+SYSCFG_TypeDef		simSYSCFG;
+ADC_TypeDef			simADC1;
+DMA_Stream_TypeDef	simDMA2_Stream0;
+DMA_TypeDef			simDMA2;
+USB_OTG_GlobalTypeDef	simUSB_OTG_FS;
+DWT_Type			simDWT;
+CoreDebug_Type		simCoreDebug;
+uint32_t			SystemCoreClock = 96000000;
+uint32_t			simNVIC[3], simNVICActive[3], simNVICPending[3];
+uint32_t			simGPIOReads, simGPIOWrites;
+
+// -fsanitize=thread makes gcc call these before each memory access. The
+// TSan runtime is not linked, they only count the accesses that fall in
+// a GPIO port.
+
+static int isGPIO(const void *addr) {
+	
+	const GPIO_TypeDef	*ports[] = {GPIOA, GPIOB, GPIOC};
+	size_t				i;
+	
+	for(i = 0; i < sizeof(ports) / sizeof(ports[0]); ++i)
+		if(((const char *)addr >= (const char *)ports[i]) && ((const char *)addr < (const char *)(ports[i] + 1)))
+			return 1;
+	
+	return 0;
+}
+
+#define READ_HOOK(n)	void __tsan_read##n(void *addr) { simGPIOReads += isGPIO(addr); }
+#define WRITE_HOOK(n)	void __tsan_write##n(void *addr) { simGPIOWrites += isGPIO(addr); }
+
+READ_HOOK(1) READ_HOOK(2) READ_HOOK(4) READ_HOOK(8) READ_HOOK(16)
+WRITE_HOOK(1) WRITE_HOOK(2) WRITE_HOOK(4) WRITE_HOOK(8) WRITE_HOOK(16)
+
+void __tsan_init(void) {
+}
+
+void __tsan_func_entry(__attribute__((unused)) void *pc) {
+}
+
+void __tsan_func_exit(void) {
+}
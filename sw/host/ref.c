@@ -0,0 +1,45 @@
+// Byte-wise reference unpacking, see ref.h
+
+#include <stdint.h>
+#include "ref.h"
+
+// 24-bit frames, as the original ept1_callback after usbd_ep_read
+void RefUnpack24(uint16_t *dst, const uint8_t *buf, int nFrames) {
+	
+	int			i;
+	uint32_t	sampleL, sampleR;
+	
+	for(i = 0; i < nFrames; ++i) {
+		sampleL = buf[i * 6] | ((uint32_t)buf[i * 6 + 1] << 8) | ((uint32_t)buf[i * 6 + 2] << 16);
+		sampleR = buf[i * 6 + 3] | ((uint32_t)buf[i * 6 + 4] << 8) | ((uint32_t)buf[i * 6 + 5] << 16);
+	
+		dst[4 * i] = (sampleL >> 8) & 0xffff;
+		dst[4 * i + 1] = (sampleL << 8) & 0xff00;
+		dst[4 * i + 2] = (sampleR >> 8) & 0xffff;
+		dst[4 * i + 3] = (sampleR << 8) & 0xff00;
+	}
+}
+
+// 16-bit frames, the low byte of each I2S sample is zero
+void RefUnpack16(uint16_t *dst, const uint8_t *buf, int nFrames) {
+	
+	int		i;
+	
+	for(i = 0; i < nFrames; ++i) {
+		dst[4 * i] = buf[i * 4] | (buf[i * 4 + 1] << 8);
+		dst[4 * i + 1] = 0;
+		dst[4 * i + 2] = buf[i * 4 + 2] | (buf[i * 4 + 3] << 8);
+		dst[4 * i + 3] = 0;
+	}
+}
+
+// 24-bit samples in 32-bit containers, the padding byte first
+void RefUnpack32(uint16_t *dst, const uint8_t *buf, int nFrames) {
+	
+	int		i;
+	
+	for(i = 0; i < 2 * nFrames; ++i) {
+		dst[2 * i] = buf[i * 4 + 2] | (buf[i * 4 + 3] << 8);
+		dst[2 * i + 1] = buf[i * 4 + 1] << 8;
+	}
+}
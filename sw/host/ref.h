@@ -0,0 +1,12 @@
+#ifndef REF_H_
+#define	REF_H_
+
+// Byte-wise reference versions of the sample unpacking, as the firmware
+// did it before the word-wise kernels in pcm.c. Used as the golden output
+// in the tests and as the old path in bench_pcm.
+
+void RefUnpack24(uint16_t *dst, const uint8_t *buf, int nFrames);
+void RefUnpack16(uint16_t *dst, const uint8_t *buf, int nFrames);
+void RefUnpack32(uint16_t *dst, const uint8_t *buf, int nFrames);
+
+#endif
@@ -0,0 +1,293 @@
+// Host simulation of the streaming core, see sim.h
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "arm_math.h"
+#include "audio.h"
+#include "audio_hal.h"
+#include "usb_fifo.h"
+#include "feedback.h"
+#include "i2s_pll.h"
+#include "sim.h"
+
+volatile int		simRemaining, simTarget, simStreaming;
+
+static uint32_t		packet[MAX_PACKET_FRAMES * 2 + 1];
+static int64_t		overhead;		// Cost of reading the clock
+
+static int64_t now(void) {
+	
+	struct timespec	t;
+	
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	
+	return (int64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+// Time since t without the cost of reading the clock, which is larger than
+// the shortest interrupt work and would make it negative
+static int64_t elapsed(int64_t t) {
+	
+	t = now() - t - overhead;
+	
+	return t > 0 ? t : 0;
+}
+
+// Test signal: full scale white noise, the same for every run
+int32_t SimSample(uint32_t n, int ch) {
+	
+	uint32_t	x = n * 2 + ch + 1;
+	
+	x ^= x >> 16;
+	x *= 0x7feb352d;
+	x ^= x >> 15;
+	x *= 0x846ca68b;
+	x ^= x >> 16;
+	
+	return (int32_t)x;
+}
+
+// Build a packet of nFrames frames, starting at frame n, in the format of
+// the alternate setting for bits. Returns the number of bytes.
+static int buildPacket(int bits, uint32_t n, int nFrames) {
+	
+	uint8_t		*p = (uint8_t *)packet;
+	int			i, ch;
+	uint32_t	s;
+	
+	for(i = 0; i < nFrames; ++i)
+		for(ch = 0; ch < 2; ++ch) {
+			s = (uint32_t)SimSample(n + i, ch);
+			if(bits == 16) {
+				*p++ = s >> 16;
+				*p++ = s >> 24;
+			}
+			else if(bits == 24) {
+				*p++ = s >> 8;
+				*p++ = s >> 16;
+				*p++ = s >> 24;
+			}
+			else {
+				memcpy(p, &s, 4);
+				p += 4;
+			}
+		}
+	
+	return p - (uint8_t *)packet;
+}
+
+static void resetAudio(const struct sim_stream *s) {
+	
+	int		target = AudioTarget(s->fs, s->latency ? s->latency : LATENCY_MS);
+	
+	// As EnableAudio
+	audio_status.writePtr = 3;
+	audio_status.readPtr = 0;
+	audio_status.diff = 0;
+	audio_status.written = audio_status.writePtr;
+	audio_status.consumed = 0;
+	audio_status.dmaHalf = 0;
+	audio_status.underruns = 0;
+	audio_status.overruns = 0;
+	audio_status.target = target;
+	audio_status.bufLen = 2 * target;
+	memset((uint16_t *)audio_buffer, 0, sizeof(audio_buffer));
+#ifdef AUDIO_PIPELINE
+	memset((uint16_t *)audio_block, 0, sizeof(audio_block));
+	simRemaining = PIPE_LEN;
+#else
+	simRemaining = audio_status.bufLen;
+#endif
+	simTarget = 0;
+	simStreaming = 0;
+	
+	AudioSetVolume(s->volume);
+	AudioFadeIn(0);
+}
+
+// Let the DMA read n halfwords and run its interrupt work. Returns the time
+// spent in the interrupt work in ns.
+static int64_t consume(int n, const struct sim_stream *s, struct sim_stats *st) {
+	
+	int64_t		t, ns = 0;
+	uint16_t	v;
+#ifndef AUDIO_PIPELINE
+	int			len = audio_status.bufLen;
+#endif
+	
+	if(!simStreaming)
+		return 0;
+	
+	while(n-- > 0) {
+#ifdef AUDIO_PIPELINE
+		v = audio_block[simTarget][PIPE_LEN - simRemaining];
+		if(--simRemaining == 0) {
+			simRemaining = PIPE_LEN;
+			simTarget ^= 1;
+			t = now();
+			AudioBlockSwap(simTarget);
+			ns += elapsed(t);
+		}
+#else
+		v = audio_buffer[len - simRemaining];
+		if(--simRemaining == len / 2) {
+			t = now();
+			AudioHalfTransfer(1);
+			ns += elapsed(t);
+		}
+		else if(simRemaining == 0) {
+			simRemaining = len;
+			t = now();
+			AudioHalfTransfer(0);
+			ns += elapsed(t);
+		}
+#endif
+		if(s->out && (st->outCount < s->outLen))
+			s->out[st->outCount++] = v;
+	}
+	
+	return ns;
+}
+
+static int cmp64(const void *a, const void *b) {
+	
+	int64_t		d = *(const int64_t *)a - *(const int64_t *)b;
+	
+	return d < 0 ? -1 : (d > 0);
+}
+
+// Median of n times, which is not thrown off by the scheduler like the mean
+static double median(int64_t *t, int n) {
+	
+	qsort(t, n, sizeof(t[0]), cmp64);
+	
+	return n % 2 ? t[n / 2] : (t[n / 2 - 1] + t[n / 2]) / 2.0;
+}
+
+// Run a stream. Returns 0 if the sampling frequency is not supported.
+int SimRun(const struct sim_stream *s, struct sim_stats *st) {
+	
+	const struct i2s_pll	*pll = 0;
+	FeedbackPI	pi;
+	unsigned	i;
+	double		fsDev, mclk = 0, dma = 0, sum = 0, sum2 = 0, fbSum = 0;
+	int64_t		t, *nsPacket, nsDMA = 0;
+	uint32_t	hostFb, hostAcc = 0, fbAcc = 0, fb;
+	uint32_t	frame = 0;
+	int			ms, n, ccr, diff, delta, sofNum = 0, playing = 0, nFb = 0, last;
+	
+	for(i = 0; i < sizeof(i2s_pll_table) / sizeof(i2s_pll_table[0]); ++i)
+		if(i2s_pll_table[i].fs == s->fs)
+			pll = &i2s_pll_table[i];
+	if(!pll || s->ms < 1)
+		return 0;
+	
+	memset(st, 0, sizeof(*st));
+	st->fillMin = INT32_MAX;
+	st->fillMax = INT32_MIN;
+	nsPacket = malloc(s->ms * sizeof(int64_t));
+	resetAudio(s);
+	FeedbackInit(&pi, s->fs, FB_LIMIT);
+	
+	// Rate of the I2S clock and the nominal rate the host starts with
+	fsDev = pll->fb * (1000.0 / 16384) * (1 + s->ppm * 1e-6);
+	hostFb = (uint32_t)((int64_t)s->fs * 16384 / 1000);
+	last = s->ms > 1000 ? s->ms - 1000 : 0;
+	
+	t = now();
+	for(n = 0; n < 1000; ++n)
+		now();
+	overhead = (now() - t) / 1000;
+	
+	for(ms = 0; ms < s->ms; ++ms) {
+		// TIM2 captures the MCLK count at each SOF
+		mclk += 256 * fsDev / 1000;
+		ccr = (int)mclk;
+		mclk -= ccr;
+	
+		// SOF, as event_sof
+		diff = playing ? AudioFill() : audio_status.target;
+		audio_status.diff = diff;
+		delta = FeedbackUpdate(&pi, audio_status.target - diff);
+		if(++sofNum == 1 << FB_RATE) {
+			fb = (fbAcc + ccr) << 4; // 2^FB_RATE frames of MCLK = 256 fs, in 10.14
+			fb += delta;
+			if(fb > pll->fb + FB_LIMIT)
+				fb = pll->fb + FB_LIMIT;
+			if(fb < pll->fb - FB_LIMIT)
+				fb = pll->fb - FB_LIMIT;
+			hostFb = fb;
+			sofNum = 0;
+			fbAcc = 0;
+			if(ms >= last) {
+				fbSum += fb * (1000.0 / 16384);
+				nFb++;
+			}
+		}
+		else
+			fbAcc += ccr;
+	
+		if(playing && (abs(diff - audio_status.target) > FB_FILL_TOL))
+			st->settleMs = ms + 1;
+		if(!playing)
+			st->settleMs = ms + 1;
+		if(playing && (ms >= last)) {
+			diff -= audio_status.target;
+			sum += diff;
+			sum2 += (double)diff * diff;
+			if(diff < st->fillMin)
+				st->fillMin = diff;
+			if(diff > st->fillMax)
+				st->fillMax = diff;
+		}
+	
+		// The DMA reads the first half of the frame
+		dma += 2 * fsDev / 1000;
+		n = (int)dma;
+		dma -= n;
+		nsDMA += consume(n, s, st);
+	
+		// The host sends the frames its feedback accumulator has reached
+		hostAcc += hostFb;
+		n = hostAcc >> 14;
+		hostAcc &= 0x3fff;
+		buildPacket(s->bits, frame, n);
+		frame += n;
+		FifoLoad(packet);
+		t = now();
+		if(s->bits == 16)
+			AudioWrite16(&usbFifo, n);
+		else if(s->bits == 24)
+			AudioWrite24(&usbFifo, n);
+		else
+			AudioWrite32(&usbFifo, n);
+		nsPacket[ms] = elapsed(t);
+	
+		// Start playing once the buffer is filled to the target level
+		if(!playing && ((int)audio_status.written >= audio_status.target)) {
+			playing = 1;
+			simStreaming = 1;
+		}
+	
+		dma += 2 * fsDev / 1000;
+		n = (int)dma;
+		dma -= n;
+		nsDMA += consume(n, s, st);
+	}
+	
+	n = s->ms - last;
+	st->nsPacket = median(nsPacket, s->ms);
+	// Most frames have no DMA interrupt, so the median would be zero
+	st->nsDMA = (double)nsDMA / s->ms;
+	st->fillMean = sum / n;
+	st->fillSd = sqrt(sum2 / n - st->fillMean * st->fillMean);
+	st->fbPpm = nFb ? (fbSum / nFb - fsDev) / fsDev * 1e6 : 0;
+	st->underruns = audio_status.underruns;
+	st->overruns = audio_status.overruns;
+	free(nsPacket);
+	
+	return 1;
+}
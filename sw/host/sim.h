@@ -0,0 +1,38 @@
+#ifndef SIM_H_
+#define	SIM_H_
+
+// Host simulation of the streaming core. A synthetic host sends one
+// isochronous packet per 1 ms frame at the rate it reads from the
+// feedback, and a simulated I2S DMA consumes the ring buffer at the rate
+// the I2S PLL actually generates, offset by ppm to model the clock of the
+// host. The SOF handling and feedback follow event_sof in usb_streamer.c.
+
+struct sim_stream {
+	int			fs;			// Nominal sampling frequency
+	int			bits;		// 16, 24 or 32 (24-bit samples in 32-bit containers)
+	int			ppm;		// Device clock offset against the host
+	int			volume;		// In 1/256 dB, see AudioSetVolume
+	int			ms;			// Frames to run
+	int			latency;	// Target fill in ms
+	uint16_t	*out;		// Optional sink for the halfwords the DMA reads
+	int			outLen;
+};
+
+struct sim_stats {
+	double		nsPacket;	// Median time in AudioWriteXX per packet
+	double		nsDMA;		// Mean time in the DMA interrupt work per ms
+	int			fillMin;	// Fill at SOF relative to the target, halfwords
+	int			fillMax;
+	double		fillMean;
+	double		fillSd;
+	int			settleMs;	// First frame after which the fill stays within FB_FILL_TOL
+	double		fbPpm;		// Mean feedback error over the last second
+	uint32_t	underruns;
+	uint32_t	overruns;
+	int			outCount;	// Halfwords written to out
+};
+
+int32_t SimSample(uint32_t n, int ch);
+int SimRun(const struct sim_stream *s, struct sim_stats *st);
+
+#endif
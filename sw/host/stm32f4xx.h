@@ -0,0 +1,261 @@
+#ifndef STM32F4XX_H
+#define	STM32F4XX_H
+
+// Device header for the host build. The streaming core only needs the core
+// intrinsics from it. The LED ramp, ADC and button handlers and the
+// profiler also get the registers they use, as plain memory in periph.c
+// that the tests set and read back. Nothing happens on a register write:
+// set and clear registers such as BSRR and LIFCR keep the last value
+// written, and a test applies them where it needs their effect.
+
+#include <stdint.h>
+#include "cmsis_host.h"
+
+#define __IO	volatile
+
+typedef enum {
+	EXTI0_IRQn			= 6,
+	EXTI1_IRQn			= 7,
+	EXTI2_IRQn			= 8,
+	EXTI4_IRQn			= 10,
+	TIM4_IRQn			= 30,
+	TIM5_IRQn			= 50,
+	DMA2_Stream0_IRQn	= 56,
+	OTG_FS_IRQn			= 67,
+} IRQn_Type;
+
+typedef struct {
+	__IO uint32_t	MODER;
+	__IO uint32_t	OTYPER;
+	__IO uint32_t	OSPEEDR;
+	__IO uint32_t	PUPDR;
+	__IO uint32_t	IDR;
+	__IO uint32_t	ODR;
+	__IO uint32_t	BSRR;
+} GPIO_TypeDef;
+
+typedef struct {
+	__IO uint32_t	CR1;
+	__IO uint32_t	CR2;
+	__IO uint32_t	DIER;
+	__IO uint32_t	SR;
+	__IO uint32_t	CNT;
+	__IO uint32_t	PSC;
+	__IO uint32_t	ARR;
+} TIM_TypeDef;
+
+typedef struct {
+	__IO uint32_t	AHB1ENR;
+	__IO uint32_t	APB1ENR;
+	__IO uint32_t	APB2ENR;
+} RCC_TypeDef;
+
+typedef struct {
+	__IO uint32_t	IMR;
+	__IO uint32_t	EMR;
+	__IO uint32_t	RTSR;
+	__IO uint32_t	FTSR;
+	__IO uint32_t	SWIER;
+	__IO uint32_t	PR;
+} EXTI_TypeDef;
+
+typedef struct {
+	__IO uint32_t	MEMRMP;
+	__IO uint32_t	PMC;
+	__IO uint32_t	EXTICR[4];
+} SYSCFG_TypeDef;
+
+typedef struct {
+	__IO uint32_t	SR;
+	__IO uint32_t	CR1;
+	__IO uint32_t	CR2;
+	__IO uint32_t	SMPR1;
+	__IO uint32_t	SMPR2;
+	__IO uint32_t	SQR1;
+	__IO uint32_t	SQR2;
+	__IO uint32_t	SQR3;
+	__IO uint32_t	DR;
+} ADC_TypeDef;
+
+// The address registers are wide enough for a host pointer
+typedef struct {
+	__IO uint32_t	CR;
+	__IO uint32_t	NDTR;
+	__IO uintptr_t	PAR;
+	__IO uintptr_t	M0AR;
+	__IO uintptr_t	M1AR;
+	__IO uint32_t	FCR;
+} DMA_Stream_TypeDef;
+
+typedef struct {
+	__IO uint32_t	LISR;
+	__IO uint32_t	HISR;
+	__IO uint32_t	LIFCR;
+	__IO uint32_t	HIFCR;
+} DMA_TypeDef;
+
+typedef struct {
+	__IO uint32_t	GOTGCTL;
+	__IO uint32_t	GOTGINT;
+	__IO uint32_t	GAHBCFG;
+	__IO uint32_t	GUSBCFG;
+	__IO uint32_t	GRSTCTL;
+	__IO uint32_t	GINTSTS;
+} USB_OTG_GlobalTypeDef;
+
+typedef struct {
+	__IO uint32_t	CTRL;
+	__IO uint32_t	CYCCNT;
+} DWT_Type;
+
+typedef struct {
+	__IO uint32_t	DHCSR;
+	__IO uint32_t	DCRSR;
+	__IO uint32_t	DCRDR;
+	__IO uint32_t	DEMCR;
+} CoreDebug_Type;
+
+extern GPIO_TypeDef			simGPIOA, simGPIOB, simGPIOC;
+extern TIM_TypeDef			simTIM3, simTIM4, simTIM5;
+extern RCC_TypeDef			simRCC;
+extern EXTI_TypeDef			simEXTI;
+extern SYSCFG_TypeDef		simSYSCFG;
+extern ADC_TypeDef			simADC1;
+extern DMA_Stream_TypeDef	simDMA2_Stream0;
+extern DMA_TypeDef			simDMA2;
+extern USB_OTG_GlobalTypeDef	simUSB_OTG_FS;
+extern DWT_Type				simDWT;
+extern CoreDebug_Type		simCoreDebug;
+extern uint32_t				SystemCoreClock;
+
+// Bit n for IRQn n: enabled, active and pending interrupts
+extern uint32_t				simNVIC[3], simNVICActive[3], simNVICPending[3];
+
+// Reads and writes of the GPIO registers by code built with
+// -fsanitize=thread, counted in periph.c
+extern uint32_t				simGPIOReads, simGPIOWrites;
+
+#define GPIOA			(&simGPIOA)
+#define GPIOB			(&simGPIOB)
+#define GPIOC			(&simGPIOC)
+#define TIM3			(&simTIM3)
+#define TIM4			(&simTIM4)
+#define TIM5			(&simTIM5)
+#define RCC				(&simRCC)
+#define EXTI			(&simEXTI)
+#define SYSCFG			(&simSYSCFG)
+#define ADC1			(&simADC1)
+#define DMA2_Stream0	(&simDMA2_Stream0)
+#define DMA2			(&simDMA2)
+#define USB_OTG_FS		(&simUSB_OTG_FS)
+#define DWT				(&simDWT)
+#define CoreDebug		(&simCoreDebug)
+
+static inline void NVIC_EnableIRQ(IRQn_Type irq) {
+	
+	simNVIC[irq / 32] |= 1u << (irq % 32);
+}
+
+static inline uint32_t NVIC_GetEnabled(IRQn_Type irq) {
+	
+	return (simNVIC[irq / 32] >> (irq % 32)) & 1;
+}
+
+static inline uint32_t NVIC_GetActive(IRQn_Type irq) {
+	
+	return (simNVICActive[irq / 32] >> (irq % 32)) & 1;
+}
+
+static inline uint32_t NVIC_GetPendingIRQ(IRQn_Type irq) {
+	
+	return (simNVICPending[irq / 32] >> (irq % 32)) & 1;
+}
+
+// Bits, as in stm32f411xe.h
+
+#define GPIO_IDR_ID0				(1u << 0)
+#define GPIO_IDR_ID1				(1u << 1)
+#define GPIO_IDR_ID2				(1u << 2)
+#define GPIO_IDR_ID4				(1u << 4)
+
+#define GPIO_BSRR_BS2				(1u << 2)
+#define GPIO_BSRR_BS3				(1u << 3)
+#define GPIO_BSRR_BS7				(1u << 7)
+#define GPIO_BSRR_BS8				(1u << 8)
+#define GPIO_BSRR_BS9				(1u << 9)
+#define GPIO_BSRR_BS10				(1u << 10)
+#define GPIO_BSRR_BS14				(1u << 14)
+#define GPIO_BSRR_BS15				(1u << 15)
+#define GPIO_BSRR_BR2				(1u << 18)
+#define GPIO_BSRR_BR3				(1u << 19)
+#define GPIO_BSRR_BR7				(1u << 23)
+#define GPIO_BSRR_BR8				(1u << 24)
+#define GPIO_BSRR_BR9				(1u << 25)
+#define GPIO_BSRR_BR10				(1u << 26)
+#define GPIO_BSRR_BR14				(1u << 30)
+#define GPIO_BSRR_BR15				(1u << 31)
+
+#define TIM_CR1_CEN					(1u << 0)
+#define TIM_CR2_MMS					(7u << 4)
+#define TIM_CR2_MMS_1				(2u << 4)
+#define TIM_DIER_UIE				(1u << 0)
+#define TIM_SR_UIF					(1u << 0)
+
+#define RCC_AHB1ENR_DMA2EN			(1u << 22)
+#define RCC_APB1ENR_TIM3EN			(1u << 1)
+#define RCC_APB1ENR_TIM4EN			(1u << 2)
+#define RCC_APB1ENR_TIM5EN			(1u << 3)
+#define RCC_APB2ENR_ADC1EN			(1u << 8)
+#define RCC_APB2ENR_SYSCFGEN		(1u << 14)
+
+#define EXTI_IMR_MR0				(1u << 0)
+#define EXTI_IMR_MR1				(1u << 1)
+#define EXTI_IMR_MR2				(1u << 2)
+#define EXTI_IMR_MR4				(1u << 4)
+
+#define SYSCFG_EXTICR1_EXTI0		(0xfu << 0)
+#define SYSCFG_EXTICR1_EXTI1		(0xfu << 4)
+#define SYSCFG_EXTICR1_EXTI2		(0xfu << 8)
+#define SYSCFG_EXTICR1_EXTI0_PB		(1u << 0)
+#define SYSCFG_EXTICR1_EXTI1_PB		(1u << 4)
+#define SYSCFG_EXTICR1_EXTI2_PB		(1u << 8)
+#define SYSCFG_EXTICR2_EXTI4		(0xfu << 0)
+#define SYSCFG_EXTICR2_EXTI4_PA		0u
+
+#define ADC_CR1_SCAN				(1u << 8)
+#define ADC_CR2_ADON				(1u << 0)
+#define ADC_CR2_CONT				(1u << 1)
+#define ADC_CR2_DMA					(1u << 8)
+#define ADC_CR2_DDS					(1u << 9)
+#define ADC_CR2_EOCS				(1u << 10)
+#define ADC_CR2_EXTSEL_Pos			24
+#define ADC_CR2_EXTSEL				(0xfu << ADC_CR2_EXTSEL_Pos)
+#define ADC_CR2_EXTEN_Pos			28
+#define ADC_CR2_EXTEN				(3u << ADC_CR2_EXTEN_Pos)
+#define ADC_CR2_SWSTART				(1u << 30)
+#define ADC_SQR1_L_Pos				20
+#define ADC_SQR3_SQ2_Pos			5
+
+#define DMA_SxCR_EN					(1u << 0)
+#define DMA_SxCR_HTIE				(1u << 3)
+#define DMA_SxCR_TCIE				(1u << 4)
+#define DMA_SxCR_CIRC				(1u << 8)
+#define DMA_SxCR_MINC				(1u << 10)
+#define DMA_SxCR_PSIZE_Pos			11
+#define DMA_SxCR_MSIZE_Pos			13
+
+#define DMA_LISR_TEIF0				(1u << 3)
+#define DMA_LISR_HTIF0				(1u << 4)
+#define DMA_LISR_TCIF0				(1u << 5)
+#define DMA_LIFCR_CFEIF0			(1u << 0)
+#define DMA_LIFCR_CDMEIF0			(1u << 2)
+#define DMA_LIFCR_CTEIF0			(1u << 3)
+#define DMA_LIFCR_CHTIF0			(1u << 4)
+#define DMA_LIFCR_CTCIF0			(1u << 5)
+
+#define USB_OTG_GINTSTS_SOF			(1u << 3)
+
+#define DWT_CTRL_CYCCNTENA_Msk		(1u << 0)
+#define CoreDebug_DEMCR_TRCENA_Msk	(1u << 24)
+
+#endif
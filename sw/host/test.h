@@ -0,0 +1,22 @@
+#ifndef TEST_H_
+#define	TEST_H_
+
+// Minimal checks for the host tests. Each test program returns the number
+// of failed checks.
+
+#include <stdio.h>
+
+static int	testFails = 0;
+
+#define CHECK(cond, ...)	do { \
+		if(!(cond)) { \
+			printf("%s:%d: FAIL: ", __FILE__, __LINE__); \
+			printf(__VA_ARGS__); \
+			printf("\n"); \
+			testFails++; \
+		} \
+	} while(0)
+
+#define TEST_DONE()	(printf("%s: %s\n", __FILE__, testFails ? "FAILED" : "ok"), testFails)
+
+#endif
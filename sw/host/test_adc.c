@@ -0,0 +1,101 @@
+// Test of the level ADC averaging: DMA2 stream 0 set up for a circular
+// buffer of interleaved conversions, and the half and full transfer
+// interrupts giving the mean of the last NSAMP conversions per channel.
+// The DMA is modelled by writing conversions to the buffer and raising
+// the transfer flags at each half.
+
+#include <stdint.h>
+#include <stdlib.h>
+#include "stm32f4xx.h"
+#include "adc.c"
+#include "test.h"
+
+#define HISTORY		(4 * NSAMP)
+
+static uint16_t		history[2][HISTORY];
+static int			pos, written;		// Next halfword of the buffer, conversions per channel
+
+// Convert n frames of both channels, raising the interrupts as the DMA would
+static void convert(int n, int (*level)(int i, int ch)) {
+	
+	int		ch;
+	
+	for(; n > 0; --n) {
+		for(ch = 0; ch < 2; ++ch) {
+			history[ch][written % HISTORY] = level(written, ch);
+			samples[pos++] = history[ch][written % HISTORY];
+		}
+		written++;
+	
+		if((pos == NSAMP) || (pos == 2 * NSAMP)) {
+			DMA2->LISR = pos == NSAMP ? DMA_LISR_HTIF0 : DMA_LISR_TCIF0;
+			DMA2_Stream0_IRQHandler();
+			pos %= 2 * NSAMP;
+		}
+	}
+}
+
+// Mean of the last NSAMP conversions of ch, as the firmware rounds it
+static int mean(int ch) {
+	
+	int		i, s = 0;
+	
+	for(i = written - NSAMP; i < written; ++i)
+		s += history[ch][i % HISTORY];
+	
+	return s >> 9;
+}
+
+static int noise(int i, int ch) {
+	
+	return ((i * 0x9e3779b9u + ch * 0x7f4a7c15u) >> 20) & 0xfff;
+}
+
+static int step(int i, int ch) {
+	
+	return i < 3 * NSAMP / 2 ? 100 : (ch ? 4095 : 2000);
+}
+
+int main(void) {
+	
+	int		ch, i;
+	
+	ADCInit();
+	
+	// adc.c writes the addresses as 32 bits
+	CHECK((uint32_t)DMA2_Stream0->M0AR == (uint32_t)(uintptr_t)samples, "DMA to the sample buffer");
+	CHECK(DMA2_Stream0->NDTR == 2 * NSAMP, "NDTR %u", (unsigned)DMA2_Stream0->NDTR);
+	CHECK((DMA2_Stream0->CR & (DMA_SxCR_EN | DMA_SxCR_CIRC | DMA_SxCR_MINC | DMA_SxCR_HTIE | DMA_SxCR_TCIE)) ==
+		  (DMA_SxCR_EN | DMA_SxCR_CIRC | DMA_SxCR_MINC | DMA_SxCR_HTIE | DMA_SxCR_TCIE), "DMA CR %08x",
+		  (unsigned)DMA2_Stream0->CR);
+	CHECK((ADC1->CR2 & (ADC_CR2_DMA | ADC_CR2_DDS | ADC_CR2_CONT)) == (ADC_CR2_DMA | ADC_CR2_DDS), "ADC CR2 %08x",
+		  (unsigned)ADC1->CR2);
+	CHECK((TIM3->CR1 & TIM_CR1_CEN) && NVIC_GetEnabled(DMA2_Stream0_IRQn), "trigger timer and interrupt enabled");
+	
+	// After the first full buffer the mean is over the last NSAMP
+	// conversions, updated every NSAMP / 2
+	convert(NSAMP, noise);
+	for(i = 0; i < 8; ++i) {
+		convert(NSAMP / 2, noise);
+		for(ch = 0; ch < 2; ++ch)
+			CHECK(ADCRead(ch) == mean(ch), "channel %d: %d for a mean of %d", ch, ADCRead(ch), mean(ch));
+	}
+	
+	// A step is averaged in after one buffer
+	pos = written = 0;
+	convert(3 * NSAMP / 2, step);
+	CHECK((ADCRead(0) == 100) && (ADCRead(1) == 100), "before the step: %d, %d", ADCRead(0), ADCRead(1));
+	convert(NSAMP / 2, step);
+	CHECK((ADCRead(0) == (100 + 2000) / 2) && (ADCRead(1) == (100 + 4095) / 2), "half way: %d, %d", ADCRead(0),
+		  ADCRead(1));
+	convert(NSAMP / 2, step);
+	CHECK((ADCRead(0) == 2000) && (ADCRead(1) == 4095), "after the step: %d, %d", ADCRead(0), ADCRead(1));
+	
+	// An error interrupt leaves the levels alone
+	DMA2->LISR = DMA_LISR_TEIF0;
+	DMA2_Stream0_IRQHandler();
+	CHECK((ADCRead(0) == 2000) && (ADCRead(1) == 4095) && (DMA2->LIFCR & DMA_LIFCR_CTEIF0),
+		  "after a transfer error: %d, %d", ADCRead(0), ADCRead(1));
+	
+	return TEST_DONE();
+}
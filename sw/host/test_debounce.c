@@ -0,0 +1,239 @@
+// Test of the button debounce: EXTI edges wake timer 5, which samples the
+// buttons every millisecond and changes a button's state after four
+// samples in a row that differ from it, and of the events it queues,
+// with long press and repeat while a button is held. The buttons are
+// driven through the simulated GPIO input registers, an edge handler runs
+// when its line is unmasked and the timer handler every millisecond while
+// it is on.
+
+#include <stdint.h>
+#include "stm32f4xx.h"
+#include "debounce.h"
+#include "test.h"
+
+#define NBUTTONS	4
+#define SETTLE		4		// Samples for a change
+#define NEVENTS		16		// Events queued
+
+void EXTI0_IRQHandler(void);
+void EXTI1_IRQHandler(void);
+void EXTI2_IRQHandler(void);
+void EXTI4_IRQHandler(void);
+void TIM5_IRQHandler(void);
+
+// Pins of buttons 1 to 4 and their EXTI lines, which have the same number
+static const struct {
+	GPIO_TypeDef	*port;
+	uint32_t		pin;
+	int				activeHigh;
+	void			(*edge)(void);
+} pins[NBUTTONS] = {
+	{GPIOB, GPIO_IDR_ID1, 0, EXTI1_IRQHandler},
+	{GPIOB, GPIO_IDR_ID2, 1, EXTI2_IRQHandler},
+	{GPIOA, GPIO_IDR_ID4, 0, EXTI4_IRQHandler},
+	{GPIOB, GPIO_IDR_ID0, 0, EXTI0_IRQHandler},
+};
+
+#define LINES	(EXTI_IMR_MR0 | EXTI_IMR_MR1 | EXTI_IMR_MR2 | EXTI_IMR_MR4)
+
+static uint32_t				uptime;
+static struct button_event	ev[64];
+static int					nev;
+
+uint32_t getUptime(void) {
+	
+	return uptime;
+}
+
+// Set the pin of button b, and take its edge interrupt if the line is on
+static void set(int b, int down) {
+	
+	const uint32_t	pin = pins[b - 1].pin;
+	GPIO_TypeDef	*port = pins[b - 1].port;
+	
+	if(down == pins[b - 1].activeHigh)
+		port->IDR |= pin;
+	else
+		port->IDR &= ~pin;
+	
+	if(EXTI->IMR & pin)
+		pins[b - 1].edge();
+}
+
+// Run ms milliseconds, the events stay queued
+static void tick(int ms) {
+	
+	for(; ms > 0; --ms) {
+		uptime++;
+		if(TIM5->CR1 & TIM_CR1_CEN)
+			TIM5_IRQHandler();
+	}
+}
+
+// Run ms milliseconds and collect the events
+static void run(int ms) {
+	
+	tick(ms);
+	while((nev < (int)(sizeof(ev) / sizeof(ev[0]))) && buttonEvent(&ev[nev]))
+		nev++;
+}
+
+static void init(void) {
+	
+	int		b;
+	
+	TIM5->CR1 = 0;
+	EXTI->IMR = 0;
+	for(b = 1; b <= NBUTTONS; ++b)
+		set(b, 0);
+	debounceInit();
+	nev = 0;
+}
+
+static int isEvent(int i, int button, int type, uint32_t time) {
+	
+	return (i < nev) && (ev[i].button == button) && (ev[i].type == type) && (ev[i].time == time);
+}
+
+// Timer off and all button lines on, as when idle
+static int idle(void) {
+	
+	return !(TIM5->CR1 & TIM_CR1_CEN) && ((EXTI->IMR & LINES) == LINES);
+}
+
+int main(void) {
+	
+	uint32_t	t, n;
+	int			b, i;
+	
+	uptime = 1000;
+	init();
+	CHECK(idle() && (nev == 0), "not idle after init");
+	CHECK(NVIC_GetEnabled(TIM5_IRQn) && NVIC_GetEnabled(EXTI0_IRQn) && NVIC_GetEnabled(EXTI1_IRQn) &&
+		  NVIC_GetEnabled(EXTI2_IRQn) && NVIC_GetEnabled(EXTI4_IRQn), "interrupts not enabled");
+	
+	// A clean press and release of each button
+	for(b = 1; b <= NBUTTONS; ++b) {
+		init();
+		t = uptime;
+		set(b, 1);
+		CHECK((TIM5->CR1 & TIM_CR1_CEN) && !(EXTI->IMR & LINES), "button %d: edge did not start the timer", b);
+		run(SETTLE - 1);
+		CHECK(nev == 0, "button %d: pressed after %d samples", b, SETTLE - 1);
+		run(1);
+		CHECK(isEvent(0, b, BUTTON_PRESS, t + SETTLE), "button %d: no press after %d samples", b, SETTLE);
+		run(50);
+		t = uptime;
+		set(b, 0);
+		run(SETTLE + 10);
+		CHECK((nev == 2) && isEvent(1, b, BUTTON_RELEASE, t + SETTLE), "button %d: %d events, no release", b, nev);
+		CHECK(idle(), "button %d: not idle after release", b);
+	}
+	
+	// Contact bounce gives a single press and release, SETTLE samples
+	// after the last bounce
+	init();
+	for(i = 0; i < 7; ++i) {
+		set(1, !(i & 1));
+		run(1);
+	}
+	t = uptime;
+	run(50);
+	for(i = 0; i < 5; ++i) {
+		set(1, i & 1);
+		run(1);
+	}
+	run(20);
+	CHECK((nev == 2) && isEvent(0, 1, BUTTON_PRESS, t + SETTLE - 1) &&
+		  isEvent(1, 1, BUTTON_RELEASE, t + 50 + 5 + SETTLE - 1), "bounce: %d events", nev);
+	CHECK(idle(), "bounce: not idle");
+	
+	// A glitch shorter than SETTLE samples is ignored
+	init();
+	set(3, 1);
+	run(SETTLE - 2);
+	set(3, 0);
+	run(20);
+	CHECK((nev == 0) && idle(), "glitch: %d events", nev);
+	
+	// Overlapping presses of two buttons
+	init();
+	t = uptime;
+	set(1, 1);
+	run(2);
+	set(4, 1);
+	run(20);
+	set(1, 0);
+	run(10);
+	set(4, 0);
+	run(20);
+	CHECK((nev == 4) && isEvent(0, 1, BUTTON_PRESS, t + SETTLE) && isEvent(1, 4, BUTTON_PRESS, t + 2 + SETTLE) &&
+		  isEvent(2, 1, BUTTON_RELEASE, t + 22 + SETTLE) && isEvent(3, 4, BUTTON_RELEASE, t + 32 + SETTLE),
+		  "two buttons: %d events", nev);
+	CHECK(idle(), "two buttons: not idle");
+	
+	// A button held at reset is pressed without an edge
+	TIM5->CR1 = 0;
+	EXTI->IMR = 0;
+	pins[1].port->IDR |= pins[1].pin;
+	debounceInit();
+	nev = 0;
+	t = uptime;
+	run(SETTLE);
+	CHECK(isEvent(0, 2, BUTTON_PRESS, t + SETTLE), "held at reset: %d events", nev);
+	CHECK((buttonDown() == 2) && buttonNDown(2), "held at reset: button %d down", buttonDown());
+	set(2, 0);
+	run(20);
+	CHECK(idle(), "held at reset: not idle after release");
+	
+	// Held for 1.5 s: a long press after BUTTON_LONG_MS, then a repeat
+	// every BUTTON_REPEAT_MS until the release
+	init();
+	t = uptime + SETTLE;
+	set(2, 1);
+	run(1500);
+	CHECK((TIM5->CR1 & TIM_CR1_CEN) && !(EXTI->IMR & LINES), "held: timer stopped");
+	set(2, 0);
+	run(20);
+	CHECK(isEvent(0, 2, BUTTON_PRESS, t) && isEvent(1, 2, BUTTON_LONG, t + BUTTON_LONG_MS), "held: no long press");
+	for(i = 2, n = t + BUTTON_LONG_MS + BUTTON_REPEAT_MS; n < t + 1500 - SETTLE; ++i, n += BUTTON_REPEAT_MS)
+		CHECK(isEvent(i, 2, BUTTON_REPEAT, n), "held: no repeat at %u ms", (unsigned)(n - t));
+	CHECK((nev == i + 1) && isEvent(i, 2, BUTTON_RELEASE, t + 1500), "held: %d events", nev);
+	CHECK(idle(), "held: not idle after release");
+	
+	// The next press starts with a long press again, and a short press in
+	// between holds nothing back
+	nev = 0;
+	t = uptime + SETTLE;
+	set(2, 1);
+	run(BUTTON_LONG_MS + 10);
+	set(2, 0);
+	run(20);
+	CHECK((nev == 3) && isEvent(1, 2, BUTTON_LONG, t + BUTTON_LONG_MS), "held again: %d events", nev);
+	
+	// Events beyond the ring are dropped, the oldest are kept in order
+	init();
+	for(i = 0; i < NEVENTS; ++i) {
+		set(1 + (i & 3), 1);
+		tick(10);
+		set(1 + (i & 3), 0);
+		tick(10);
+	}
+	CHECK(buttonEventPending(), "ring: no event pending");
+	run(0);
+	CHECK((nev == NEVENTS) && !buttonEventPending(), "ring: %d events", nev);
+	for(i = 0; i < nev; ++i)
+		CHECK(ev[i].button == 1 + ((i / 2) & 3) && (ev[i].type == (i & 1 ? BUTTON_RELEASE : BUTTON_PRESS)) &&
+			  ((i == 0) || (ev[i].time == ev[i - 1].time + 10)), "ring: event %d is button %d type %d", i,
+			  ev[i].button, ev[i].type);
+	
+	// And taking them makes room again
+	nev = 0;
+	set(3, 1);
+	run(20);
+	CHECK((nev == 1) && (ev[0].button == 3), "ring: %d events after it was emptied", nev);
+	set(3, 0);
+	run(20);
+	
+	return TEST_DONE();
+}
@@ -0,0 +1,101 @@
+// Test of the requantization of the Q31 path to 24 bits in every dither
+// mode: the output has no bits below 24, TPDF dither leaves no DC error
+// and adds the expected noise, the noise shapers keep the error out of
+// the low frequencies, and full scale input neither wraps nor makes the
+// shapers unstable.
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+#include "arm_math.h"
+#include "pcm.h"
+#include "test.h"
+
+#define LSB			256.0
+#define NFRAMES		97
+#define NBLOCKS		2000
+
+static q31_t	buf[2 * NFRAMES];
+
+// Run NBLOCKS blocks of the constant x in mode and return the mean and
+// RMS of the output error in LSB. sum1 and sum2 get the largest first and
+// second running sums of the error of the left channel.
+static void run(int mode, q31_t x, double *mean, double *rms, double *sum1, double *sum2) {
+	
+	double	e, s = 0, ss = 0, c1 = 0, c2 = 0;
+	int		b, i, low = 0;
+	
+	PCMSetDither(mode);
+	*sum1 = *sum2 = 0;
+	for(b = 0; b < NBLOCKS; ++b) {
+		for(i = 0; i < 2 * NFRAMES; ++i)
+			buf[i] = x;
+		PCMRequantize24(buf, NFRAMES);
+		for(i = 0; i < 2 * NFRAMES; ++i) {
+			low |= buf[i] & 0xff;
+			e = (buf[i] - (double)x) / LSB;
+			s += e;
+			ss += e * e;
+			if(!(i & 1)) {
+				c1 += e;
+				c2 += c1;
+				*sum1 = fmax(*sum1, fabs(c1));
+				*sum2 = fmax(*sum2, fabs(c2));
+			}
+		}
+	}
+	CHECK(!low, "mode %d: bits below 24 set", mode);
+	
+	*mean = s / (2.0 * NFRAMES * NBLOCKS);
+	*rms = sqrt(ss / (2.0 * NFRAMES * NBLOCKS));
+}
+
+int main(void) {
+	
+	static const q31_t	levels[] = {0, 0x1234577, -0x1234577, 0x40000080};
+	double				mean, rms, sum1, sum2;
+	unsigned			i;
+	int					mode;
+	
+	CHECK(PCMGetDither() == PCM_DITHER, "mode %d at startup", PCMGetDither());
+	CHECK(!PCMSetDither(DITHER_OFF - 1) && !PCMSetDither(DITHER_SHAPE2 + 1) && (PCMGetDither() == PCM_DITHER),
+		  "out of range modes accepted");
+	
+	// Off leaves the samples for PCMPack24 to truncate
+	PCMSetDither(DITHER_OFF);
+	buf[0] = 0x123456ff;
+	PCMRequantize24(buf, 1);
+	CHECK(buf[0] == 0x123456ff, "off changed %08x to %08x", 0x123456ff, (unsigned)buf[0]);
+	
+	for(i = 0; i < sizeof(levels) / sizeof(levels[0]); ++i) {
+		// TPDF: no DC error, and the rounding and dither add up to 0.5 LSB RMS
+		run(DITHER_TPDF, levels[i], &mean, &rms, &sum1, &sum2);
+		CHECK(fabs(mean) < 0.01, "TPDF at %08x: mean error %.4f LSB", (unsigned)levels[i], mean);
+		CHECK(fabs(rms - 0.5) < 0.05, "TPDF at %08x: %.3f LSB RMS", (unsigned)levels[i], rms);
+		
+		// The error of the first order shaper is a difference, its sum
+		// is bounded by the error limit. The same for the second order
+		// shaper and the sum of the sum.
+		run(DITHER_SHAPE1, levels[i], &mean, &rms, &sum1, &sum2);
+		CHECK(sum1 <= 2 * 1024 / LSB, "first order at %08x: error sum up to %.2f LSB", (unsigned)levels[i], sum1);
+		run(DITHER_SHAPE2, levels[i], &mean, &rms, &sum1, &sum2);
+		CHECK(sum2 <= 4 * 1024 / LSB, "second order at %08x: error sum of sums up to %.2f LSB", (unsigned)levels[i],
+			  sum2);
+	}
+	
+	// Full scale clips instead of wrapping, and the shapers recover
+	for(mode = DITHER_TPDF; mode <= DITHER_SHAPE2; ++mode) {
+		for(i = 0; i < 2 * NFRAMES; ++i)
+			buf[i] = i & 1 ? -0x7fffffff - 1 : 0x7fffffff;
+		PCMSetDither(mode);
+		PCMRequantize24(buf, NFRAMES);
+		for(i = 0; i < 2 * NFRAMES; ++i)
+			CHECK(i & 1 ? buf[i] <= -0x7fffff00 : buf[i] >= 0x7ffffe00, "mode %d: full scale sample %u is %08x",
+				  mode, i, (unsigned)buf[i]);
+		
+		run(mode, 0x1234577, &mean, &rms, &sum1, &sum2);
+		CHECK(rms < 2, "mode %d: %.2f LSB RMS after full scale", mode, rms);
+	}
+	
+	return TEST_DONE();
+}
@@ -0,0 +1,50 @@
+// Test of the PI rate feedback in feedback.c, in the loop model of fbsim.c:
+// at every rate, with the device clock off by up to +-200 ppm, the fill
+// must settle within FB_FILL_TOL of the target with no offset, and the
+// feedback must converge to the device rate. The integrator must not wind
+// up while the output is limited.
+
+#include <stdint.h>
+#include <math.h>
+#include "feedback.h"
+#include "fbsim.h"
+#include "test.h"
+
+#define RUN_MS		10000
+#define SETTLE_MS	5000
+
+static const int	rates[] = {44100, 48000, 88200, 96000, 176400};
+
+int main(void) {
+	
+	struct fb_stats	st;
+	FeedbackPI		pi;
+	unsigned		i;
+	int				ppm, n, u;
+	
+	for(i = 0; i < sizeof(rates) / sizeof(rates[0]); ++i)
+		for(ppm = -200; ppm <= 200; ppm += 200) {
+			CHECK(FbSimRun(rates[i], ppm, RUN_MS, &st, NULL), "%d Hz: not run", rates[i]);
+			CHECK(st.settleMs <= SETTLE_MS, "%d Hz %+d ppm: settled after %d ms", rates[i], ppm, st.settleMs);
+			CHECK((st.fillMin >= -FB_FILL_TOL) && (st.fillMax <= FB_FILL_TOL), "%d Hz %+d ppm: fill %d..%d",
+				  rates[i], ppm, st.fillMin, st.fillMax);
+			CHECK(fabs(st.fillMean) < 1, "%d Hz %+d ppm: fill offset %.2f", rates[i], ppm, st.fillMean);
+			CHECK(fabs(st.fbPpm) < 5, "%d Hz %+d ppm: feedback off by %.1f ppm", rates[i], ppm, st.fbPpm);
+		}
+	
+	// Held at the limit for a long time, the output leaves it as soon as
+	// the error changes sign
+	FeedbackInit(&pi, 48000, FB_LIMIT);
+	for(n = 0; n < 100000; ++n)
+		u = FeedbackUpdate(&pi, 1000);
+	CHECK((u == FB_LIMIT) && pi.saturated, "output %d at a large error", u);
+	u = FeedbackUpdate(&pi, -1);
+	CHECK((u < FB_LIMIT) && !pi.saturated, "output %d after the error changed sign", u);
+	CHECK(pi.integ <= FB_LIMIT * 65536, "integrator wound up to %d", pi.integ);
+	
+	// No error, no correction
+	FeedbackInit(&pi, 96000, FB_LIMIT);
+	CHECK(FeedbackUpdate(&pi, 0) == 0, "correction without an error");
+	
+	return TEST_DONE();
+}
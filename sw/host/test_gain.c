@@ -0,0 +1,91 @@
+// Digital volume: the gain applied to the stream must match the volume to
+// within 0.001 dB once the ramp has settled. Samples may be off by the
+// truncation to 24 bits, the single precision gain (up to half an LSB at
+// full scale) and the dither. A zero-length packet in the middle of a
+// ramp must be harmless.
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+#include "arm_math.h"
+#include "pcm.h"
+#include "audio.h"
+#include "usb_fifo.h"
+#include "sim.h"
+#include "test.h"
+
+#define RUN_MS		500
+#define SETTLE_MS	200
+
+#ifdef AUDIO_PIPELINE
+#define LEAD	(3 + 2 * PIPE_LEN)
+#else
+#define LEAD	3
+#endif
+
+static uint16_t	out[RUN_MS * 4 * 97];
+
+// Largest difference in 24-bit LSBs between the output after SETTLE_MS
+// and the input scaled by the volume. dB is set to the gain error.
+static double maxError(int volume, int fs, double *dB) {
+	
+	struct sim_stream	s = {0};
+	struct sim_stats	st;
+	double				g, e, max = 0, xy = 0, xx = 0;
+	int					i, start = LEAD + 4 * SETTLE_MS * (fs / 1000);
+	int32_t				in, y;
+	
+	g = volume == VOLUME_SILENCE ? 0 : pow(10, volume / (20.0 * 256));
+	s.fs = fs;
+	s.bits = 24;
+	s.ms = RUN_MS;
+	s.volume = volume;
+	s.out = out;
+	s.outLen = sizeof(out) / sizeof(out[0]);
+	SimRun(&s, &st);
+	
+	for(i = start; i + 1 < st.outCount; i += 2) {
+		in = SimSample((i - LEAD) / 4, ((i - LEAD) / 2) & 1) >> 8;
+		y = (int32_t)(((uint32_t)out[i] << 16) | out[i + 1]) >> 8;
+		e = fabs(y - in * g);
+		if(e > max)
+			max = e;
+		xy += (double)in * y;
+		xx += (double)in * in;
+	}
+	
+	*dB = g ? 20 * log10(xy / xx / g) : 0;
+	
+	return max;
+}
+
+int main(void) {
+	
+	static const int	volumes[] = {0, -256, -6 * 256, -20 * 256, -60 * 256, VOLUME_MIN, VOLUME_SILENCE};
+	unsigned			i;
+	double				e, dB;
+	
+	PCMSetDither(DITHER_OFF);
+	for(i = 0; i < sizeof(volumes) / sizeof(volumes[0]); ++i) {
+		e = maxError(volumes[i], 96000, &dB);
+		CHECK(e <= (volumes[i] ? 1.5 : 0.0), "%d/256 dB: error %.2f LSB without dither", volumes[i], e);
+		CHECK(fabs(dB) < 0.001, "%d/256 dB: gain off by %.4f dB", volumes[i], dB);
+	}
+	
+	PCMSetDither(DITHER_TPDF);
+	for(i = 0; i < sizeof(volumes) / sizeof(volumes[0]); ++i) {
+		e = maxError(volumes[i], 44100, &dB);
+		CHECK(e <= (volumes[i] ? 2.5 : 0.0), "%d/256 dB: error %.2f LSB with TPDF dither", volumes[i], e);
+		CHECK(fabs(dB) < 0.001, "%d/256 dB: gain off by %.4f dB with TPDF dither", volumes[i], dB);
+	}
+	
+	// Zero-length isochronous packets while the gain ramps
+	AudioSetVolume(0);
+	AudioSetVolume(-40 * 256);
+	AudioWrite24(&usbFifo, 0);
+	AudioWrite16(&usbFifo, 0);
+	AudioWrite32(&usbFifo, 0);
+	CHECK(maxError(-40 * 256, 48000, &dB) <= 2.5, "volume wrong after zero-length packets");
+	
+	return TEST_DONE();
+}
@@ -0,0 +1,89 @@
+// Test of the digital level meter: RMS and peak of sines at known levels
+// in the units of the LED ramp thresholds, the channels kept apart, the
+// fall at METER_DECAY_DB_S and the immediate rise. Built with
+// DIGITAL_METER only.
+
+#include <stdint.h>
+#include <math.h>
+#include "arm_math.h"
+#include "audio.h"
+#include "meter.h"
+#include "test.h"
+
+#define READ_HZ		100
+#define FS			48000
+#define BLOCK		(FS / 1000)
+#define TOL			0.01		// Relative
+
+static q31_t	buf[2 * BLOCK];
+static int		phase;
+
+// One ms of a 1 kHz sine at dBFS left and right, -200 for silence
+static void feed(double left, double right) {
+	
+	double	a[2] = {left > -200 ? pow(10, left / 20) : 0, right > -200 ? pow(10, right / 20) : 0};
+	int		i, ch;
+	
+	for(i = 0; i < BLOCK; ++i, ++phase)
+		for(ch = 0; ch < 2; ++ch)
+			buf[2 * i + ch] = (q31_t)(a[ch] * 2147483647.0 * sin(2 * M_PI * 1000 * phase / FS + 0.1));
+	MeterBlock(buf, BLOCK);
+}
+
+// Feed the signal between two reads of each channel, then read both
+static void feedRead(double left, double right, int rms[2], int peak[2]) {
+	
+	int		i;
+	
+	for(i = 0; i < 1000 / READ_HZ; ++i)
+		feed(left, right);
+	MeterRead(0, &rms[0], &peak[0]);
+	MeterRead(1, &rms[1], &peak[1]);
+}
+
+static int near(int v, double expect) {
+	
+	return fabs(v - expect) <= TOL * expect + 1;
+}
+
+int main(void) {
+	
+	int		rms[2], peak[2], i, j;
+	double	fall;
+	
+	MeterInit(READ_HZ);
+	
+	// -6 dBFS left, -26 dBFS right
+	feedRead(-6, -26, rms, peak);
+	for(i = 0; i < 2; ++i) {
+		CHECK(near(rms[i], METER_FULL_SCALE * pow(10, (-6 - 20 * i) / 20.0) / sqrt(2)), "channel %d: RMS %d", i, rms[i]);
+		CHECK(near(peak[i], METER_FULL_SCALE * pow(10, (-6 - 20 * i) / 20.0)), "channel %d: peak %d", i, peak[i]);
+	}
+	
+	// Zero frames change nothing
+	MeterBlock(buf, 0);
+	feedRead(-6, -26, rms, peak);
+	CHECK(near(rms[0], METER_FULL_SCALE * 0.5 / sqrt(2)) && near(peak[0], METER_FULL_SCALE * 0.5),
+		  "after an empty block: RMS %d, peak %d", rms[0], peak[0]);
+	
+	// Silence for a second falls by METER_DECAY_DB_S
+	for(i = 0; i < READ_HZ; ++i)
+		feedRead(-200, -200, rms, peak);
+	fall = pow(10, -METER_DECAY_DB_S / 20.0);
+	CHECK(near(rms[0], METER_FULL_SCALE * 0.5 / sqrt(2) * fall), "RMS %d after 1 s of silence", rms[0]);
+	CHECK(near(peak[0], METER_FULL_SCALE * 0.5 * fall), "peak %d after 1 s of silence", peak[0]);
+	
+	// Falls step by step, with no jumps
+	for(j = rms[0], i = 0; i < 10; ++i) {
+		feedRead(-200, -200, rms, peak);
+		CHECK((rms[0] <= j) && (rms[0] >= j * 0.9), "fall from %d to %d in one read", j, rms[0]);
+		j = rms[0];
+	}
+	
+	// And rises at once
+	feedRead(0, 0, rms, peak);
+	CHECK(near(rms[0], METER_FULL_SCALE / sqrt(2)) && near(peak[0], METER_FULL_SCALE),
+		  "0 dBFS after silence: RMS %d, peak %d", rms[0], peak[0]);
+	
+	return TEST_DONE();
+}
@@ -0,0 +1,99 @@
+// Golden output test of the unpack kernels in pcm.c against the byte-wise
+// references in ref.c, at both halfword alignments of the destination and
+// for every packet length up to MAX_PACKET_FRAMES, read from the simulated
+// USB FIFO. The Q31 decode of each format followed by the pack must give
+// the same output.
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "arm_math.h"
+#include "pcm.h"
+#include "audio.h"
+#include "ref.h"
+#include "test.h"
+
+#define GUARD		8		// Halfwords checked on each side of the output
+#define FILL		0xdead
+
+struct kernel {
+	const char	*name;
+	int			bytes;		// Per frame
+	void		(*unpack)(uint16_t *dst, volatile uint32_t *src, int nFrames);
+	void		(*decode)(q31_t *dst, volatile uint32_t *src, int nFrames);
+	void		(*ref)(uint16_t *dst, const uint8_t *buf, int nFrames);
+};
+
+static const struct kernel	kernels[] = {
+	{"PCMUnpack24",	6,	PCMUnpack24,	PCMDecode24,	RefUnpack24},
+	{"PCMUnpack16",	4,	PCMUnpack16,	PCMDecode16,	RefUnpack16},
+	{"PCMUnpack32",	8,	PCMUnpack32,	PCMDecode32,	RefUnpack32},
+};
+
+static uint32_t		packet[MAX_PACKET_FRAMES * 2 + 1];
+static uint16_t		out[4 * MAX_PACKET_FRAMES + 2 * GUARD + 2] __attribute__((aligned(16)));
+static uint16_t		exp[4 * MAX_PACKET_FRAMES + 2 * GUARD + 2];
+static q31_t		block[2 * MAX_PACKET_FRAMES];
+
+static void load(void) {
+	
+	int		i;
+	
+	for(i = 0; i < (int)(sizeof(packet) / 4); ++i)
+		packet[i] = (uint32_t)rand() << 16 ^ rand();
+	for(i = 0; i < (int)(sizeof(out) / 2); ++i)
+		out[i] = exp[i] = FILL;
+}
+
+static void testKernel(const struct kernel *k) {
+	
+	int		align, n, len, words;
+	
+	for(align = 0; align < 2; ++align)
+		for(n = 0; n <= MAX_PACKET_FRAMES; ++n) {
+			load();
+			len = 4 * n;
+			k->ref(&exp[GUARD + align], (uint8_t *)packet, n);
+			FifoLoad(packet);
+			k->unpack(&out[GUARD + align], &usbFifo, n);
+			words = fifoNext - packet;
+	
+			CHECK(!memcmp(out, exp, (len + 2 * GUARD + 2) * 2), "%s: %d frames at offset %d differ",
+				  k->name, n, align);
+			CHECK(words == (n * k->bytes + 3) / 4, "%s: %d frames read %d words", k->name, n, words);
+		}
+}
+
+// The decode then PCMPack24, the path of a packet below 0 dB
+static void testDecode(const struct kernel *k) {
+	
+	int		n, i, words;
+	
+	for(n = 0; n <= MAX_PACKET_FRAMES; ++n) {
+		load();
+		k->ref(&exp[GUARD], (uint8_t *)packet, n);
+		FifoLoad(packet);
+		k->decode(block, &usbFifo, n);
+		words = fifoNext - packet;
+		PCMPack24(&out[GUARD], block, n);
+		
+		CHECK(!memcmp(out, exp, (4 * n + 2 * GUARD) * 2), "%s: %d frames differ after the decode and pack",
+			  k->name, n);
+		CHECK(words == (n * k->bytes + 3) / 4, "%s: decode of %d frames read %d words", k->name, n, words);
+		for(i = 0; i < 2 * n; ++i)
+			CHECK(!(block[i] & 0xff), "%s: low byte of decoded sample %d of %d frames set", k->name, i, n);
+	}
+}
+
+int main(void) {
+	
+	unsigned	i;
+	
+	srand(1);
+	for(i = 0; i < sizeof(kernels) / sizeof(kernels[0]); ++i) {
+		testKernel(&kernels[i]);
+		testDecode(&kernels[i]);
+	}
+	
+	return TEST_DONE();
+}
@@ -0,0 +1,301 @@
+// Test of the interrupt handler profiler: the records of the handler
+// times, with the DWT cycle counter set by the test, across its wrap, for
+// nested handlers and for a section timed with PROFILE_MASK, the ProfileBus
+// copies and the layout of the records sent with VENDOR_GET_PROFILE.
+//
+// And of the USB latency record. ProfileSOF is fed the cycle count of a
+// SOF interrupt each millisecond, with the device clock off against the
+// host, a little jitter, SOFs taken late and SOFs that preempt the LED
+// ramp. The record must show the lateness that was put in and not the
+// drift, and result must follow the limit and held.
+
+#define ISR_PROFILE
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include "stm32f4xx.h"
+
+// The copy of ProfileBus, which takes copyCycles and lets a handler run
+// in it when preempt is set
+static void *copy(void *dst, const void *src, size_t n);
+#define memcpy	copy
+#include "profile.c"
+#undef memcpy
+
+#include "test.h"
+
+#define RUN_SOF		5000
+#define JITTER		4		// Cycles, peak to peak
+
+struct sof_run {
+	int		ppm;			// Device clock against the host
+	int		lateEvery;		// Period in SOFs of those taken late
+	int		late;			// Cycles
+	int		preemptEvery;	// Period in SOFs of those that preempt the LED ramp
+	int		preemptLate;
+	int		heldAt;			// SOF after which the LED ramp returns with the USB interrupt pending
+	int		missAt;			// SOF that the host does not send
+	int		nLate, nPreempt;	// Counted by run
+};
+
+static uint32_t		uptime, copyCycles, copies;
+static int			preempt;
+
+uint32_t getUptime(void) {
+	
+	return uptime;
+}
+
+// Time a handler id that starts at cycle start and takes cycles
+static void handler(int id, uint32_t start, uint32_t cycles) {
+	
+	uint32_t	t;
+	
+	DWT->CYCCNT = start;
+	t = ProfileEnter();
+	DWT->CYCCNT += cycles;
+	ProfileExit(id, t);
+}
+
+static const struct profile_stat *get(int id) {
+	
+	const void	*data;
+	
+	CHECK(ProfileGet(id, &data) == sizeof(struct profile_stat), "record %d length", id);
+	
+	return data;
+}
+
+static void *copy(void *dst, const void *src, size_t n) {
+	
+	uint32_t	t;
+	
+	copies++;
+	DWT->CYCCNT += copyCycles;
+	if(preempt) {
+		t = ProfileEnter();
+		DWT->CYCCNT += 500;
+		ProfileExit(PROF_DMA, t);
+	}
+	
+	return memcpy(dst, src, n);
+}
+
+static const struct profile_bus *getBus(void) {
+	
+	const void	*data;
+	
+	CHECK(ProfileGet(PROF_MEMCPY, &data) == sizeof(struct profile_bus), "bus record length");
+	
+	return data;
+}
+
+static void masked(uint32_t cycles) {
+	
+	PROFILE_MASK();
+	DWT->CYCCNT += cycles;
+	PROFILE_UNMASK(PROF_MASKED);
+}
+
+static int counted(int n, int every) {
+	
+	return every && (n > PROFILE_SOF_SETTLE) && ((n % every) == every / 2);
+}
+
+// Feed RUN_SOF SOFs, return the latency record
+static struct profile_latency run(struct sof_run *r) {
+	
+	const void	*data;
+	double		t = 4294967296.0 - 1e6, period = SystemCoreClock / 1000.0 * (1 + r->ppm * 1e-6);
+	uint32_t	entry;
+	int			n;
+	
+	ProfileInit();
+	USB_OTG_FS->GINTSTS = USB_OTG_GINTSTS_SOF;
+	r->nLate = r->nPreempt = 0;
+	
+	// Starts just before the cycle counter wraps
+	for(n = 0; n < RUN_SOF; ++n, t += period) {
+		if(n == r->missAt)
+			continue;
+		entry = (uint32_t)(uint64_t)t + ((n * 0x9e3779b9u) >> 30);
+	
+		if(counted(n, r->lateEvery)) {
+			entry += r->late;
+			r->nLate++;
+		}
+		if(counted(n, r->preemptEvery)) {
+			entry += r->preemptLate;
+			simNVICActive[TIM4_IRQn / 32] |= 1u << (TIM4_IRQn % 32);
+			r->nPreempt++;
+		}
+	
+		ProfileSOF(entry);
+		simNVICActive[TIM4_IRQn / 32] = 0;
+	
+		if(n == r->heldAt) {
+			simNVICPending[OTG_FS_IRQn / 32] |= 1u << (OTG_FS_IRQn % 32);
+			ProfileExit(PROF_TIM4, ProfileEnter());
+			simNVICPending[OTG_FS_IRQn / 32] = 0;
+		}
+	}
+	
+	CHECK(ProfileGet(PROF_LATENCY, &data) == sizeof(struct profile_latency), "latency record length");
+	
+	return *(const struct profile_latency *)data;
+}
+
+static int near(uint32_t v, int expect) {
+	
+	return ((int)v >= expect - JITTER) && ((int)v <= expect + JITTER);
+}
+
+int main(void) {
+	
+	const struct profile_summary	*sum;
+	const struct profile_stat		*s;
+	const void						*data;
+	struct profile_latency			l;
+	struct sof_run					r;
+	uint32_t						t, n;
+	int								i, ppm;
+	
+	// Sent as they are, so the layout must not depend on the ABI
+	CHECK((sizeof(struct profile_stat) == 84) && (offsetof(struct profile_stat, sum) == 12) &&
+		  (offsetof(struct profile_stat, hist) == 20), "profile_stat layout, %d bytes", (int)sizeof(struct profile_stat));
+	CHECK(sizeof(struct profile_summary) == 8, "profile_summary is %d bytes", (int)sizeof(struct profile_summary));
+	CHECK((sizeof(struct profile_bus) == 92) && (offsetof(struct profile_bus, stat) == 8), "profile_bus layout");
+	CHECK((sizeof(struct profile_latency) == 96) && (offsetof(struct profile_latency, hist) == 32),
+		  "profile_latency layout, %d bytes", (int)sizeof(struct profile_latency));
+	
+	ProfileInit();
+	CHECK((CoreDebug->DEMCR & CoreDebug_DEMCR_TRCENA_Msk) && (DWT->CTRL & DWT_CTRL_CYCCNTENA_Msk),
+		  "cycle counter not enabled");
+	s = get(PROF_OTG);
+	CHECK((s->count == 0) && (s->min == 0xffffffff) && (s->max == 0) && (s->sum == 0), "not empty after init");
+	
+	// Count, min, max, sum and the log2 bins
+	handler(PROF_DMA, 1000, 100);
+	handler(PROF_DMA, 5000, 1);
+	handler(PROF_DMA, 9000, 300);
+	handler(PROF_DMA, 20000, 1 << 20);
+	s = get(PROF_DMA);
+	CHECK((s->count == 4) && (s->min == 1) && (s->max == 1 << 20) && (s->sum == 401 + (1 << 20)),
+		  "DMA: count %u, min %u, max %u, sum %llu", (unsigned)s->count, (unsigned)s->min, (unsigned)s->max,
+		  (unsigned long long)s->sum);
+	CHECK((s->hist[0] == 1) && (s->hist[6] == 1) && (s->hist[8] == 1) && (s->hist[PROFILE_BINS - 1] == 1),
+		  "DMA: histogram");
+	CHECK(get(PROF_ADC)->count == 0, "other records changed");
+	
+	// Across the wrap of the cycle counter
+	handler(PROF_TIM4, 0xfffffff0, 0x20);
+	s = get(PROF_TIM4);
+	CHECK((s->count == 1) && (s->max == 0x20), "wrap: %u cycles", (unsigned)s->max);
+	
+	// A preempting handler is counted in both, and the nesting in the summary
+	DWT->CYCCNT = 0;
+	t = ProfileEnter();
+	handler(PROF_OTG, 50, 200);
+	DWT->CYCCNT = 400;
+	ProfileExit(PROF_TIM5, t);
+	CHECK((get(PROF_OTG)->max == 200) && (get(PROF_TIM5)->max == 400), "nested: %u and %u cycles",
+		  (unsigned)get(PROF_OTG)->max, (unsigned)get(PROF_TIM5)->max);
+	CHECK(ProfileGet(PROF_COUNT, &data) == sizeof(struct profile_summary), "summary length");
+	sum = data;
+	CHECK((sum->handlers == PROF_COUNT) && (sum->maxNesting == 2) && (sum->bins == PROFILE_BINS) &&
+		  (sum->clock == SystemCoreClock), "summary %u %u %u %u", sum->handlers, sum->maxNesting, sum->bins,
+		  (unsigned)sum->clock);
+	
+	// A masked section is a record of its own and not a handler
+	masked(150);
+	masked(90);
+	s = get(PROF_MASKED);
+	CHECK((s->count == 2) && (s->min == 90) && (s->max == 150), "masked: count %u, min %u, max %u",
+		  (unsigned)s->count, (unsigned)s->min, (unsigned)s->max);
+	handler(PROF_PENDSV, 0, 10);
+	ProfileGet(PROF_COUNT, &data);
+	CHECK(((const struct profile_summary *)data)->maxNesting == 2, "nesting left over");
+	
+	CHECK(!ProfileGet(-1, &data) && !ProfileGet(PROF_LATENCY + 1, &data), "records beyond PROF_LATENCY");
+	
+	// ProfileBus copies only when asked to, once per ms
+	uptime = 1;
+	for(i = 0; i < 10; ++i, ++uptime)
+		ProfileBus();
+	CHECK((copies == 0) && (getBus()->stat.count == 0), "bus: %u copies before it was started", (unsigned)copies);
+	copyCycles = 2000;
+	ProfileBusStart(5);
+	ProfileBus();
+	ProfileBus();
+	CHECK((copies == 1) && (getBus()->pending == 4), "bus: %u copies in one ms", (unsigned)copies);
+	
+	// A copy during which a handler ran is discarded
+	preempt = 1;
+	uptime++;
+	ProfileBus();
+	preempt = 0;
+	CHECK((getBus()->discarded == 1) && (getBus()->stat.count == 1), "bus: preempted copy kept");
+	copyCycles = 2100;
+	for(i = 0; i < 10; ++i, ++uptime)
+		ProfileBus();
+	CHECK((copies == 5) && (getBus()->pending == 0), "bus: %u copies for 5", (unsigned)copies);
+	CHECK((getBus()->stat.count == 4) && (getBus()->stat.min == 2000) && (getBus()->stat.max == 2100) &&
+		  (getBus()->stat.sum == 2000 + 3 * 2100), "bus: count %u, min %u, max %u", (unsigned)getBus()->stat.count,
+		  (unsigned)getBus()->stat.min, (unsigned)getBus()->stat.max);
+	
+	ProfileReset();
+	for(i = 0; i < PROF_COUNT; ++i)
+		CHECK((get(i)->count == 0) && (get(i)->min == 0xffffffff), "record %d not reset", i);
+	ProfileGet(PROF_COUNT, &data);
+	CHECK(((const struct profile_summary *)data)->maxNesting == 0, "nesting not reset");
+	CHECK((getBus()->stat.count == 0) && (getBus()->discarded == 0), "bus record not reset");
+	
+	for(ppm = -500; ppm <= 500; ppm += 500) {
+		r = (struct sof_run){ppm, 250, 500, 100, 40, -1, -1, 0, 0};
+		l = run(&r);
+	
+		CHECK(l.count == RUN_SOF - PROFILE_SOF_SETTLE, "%+d ppm: %u SOFs counted", ppm, (unsigned)l.count);
+		CHECK(abs((int)l.period - (int)(SystemCoreClock / 1000 * (1 + ppm * 1e-6))) <= 1,
+			  "%+d ppm: mean interval %u", ppm, (unsigned)l.period);
+		CHECK(near(l.max, r.late), "%+d ppm: max %u for %d", ppm, (unsigned)l.max, r.late);
+		CHECK(near(l.maxPreempted, r.preemptLate), "%+d ppm: maxPreempted %u for %d", ppm,
+			  (unsigned)l.maxPreempted, r.preemptLate);
+		CHECK(l.preempted == (uint32_t)r.nPreempt, "%+d ppm: %u preempted for %d", ppm, (unsigned)l.preempted,
+			  r.nPreempt);
+	
+		// Only the late SOFs are beyond the jitter, the drift is not counted
+		for(n = 0, i = 4; i < PROFILE_BINS; ++i)
+			n += l.hist[i];
+		CHECK(n == (uint32_t)(r.nLate + r.nPreempt), "%+d ppm: %u SOFs 16 cycles late or more for %d", ppm,
+			  (unsigned)n, r.nLate + r.nPreempt);
+	
+		CHECK(l.limit == SystemCoreClock / 1000000 * PROFILE_LATENCY_US, "%+d ppm: limit %u", ppm, (unsigned)l.limit);
+		CHECK((l.held == 0) && (l.result == PROFILE_PASS), "%+d ppm: held %u, result %u", ppm, (unsigned)l.held,
+			  (unsigned)l.result);
+	}
+	
+	// A missed SOF is skipped, not counted as late
+	r = (struct sof_run){300, 0, 0, 100, 40, -1, 3000, 0, 0};
+	l = run(&r);
+	CHECK(near(l.max, r.preemptLate) && (l.count == RUN_SOF - PROFILE_SOF_SETTLE - 2), "missed SOF: max %u, count %u",
+		  (unsigned)l.max, (unsigned)l.count);
+	
+	// Over the limit
+	r = (struct sof_run){300, 0, 0, 100, SystemCoreClock / 1000000 * PROFILE_LATENCY_US + 100, -1, -1, 0, 0};
+	l = run(&r);
+	CHECK(l.result == PROFILE_FAIL, "preempted SOF late by %u: result %u", (unsigned)l.maxPreempted, (unsigned)l.result);
+	
+	// The LED ramp held the USB interrupt
+	r = (struct sof_run){300, 0, 0, 100, 40, 2000, -1, 0, 0};
+	l = run(&r);
+	CHECK((l.held == 1) && (l.result == PROFILE_FAIL), "held: %u, result %u", (unsigned)l.held, (unsigned)l.result);
+	
+	// No SOF preempted the handlers
+	r = (struct sof_run){300, 250, 500, 0, 0, -1, -1, 0, 0};
+	l = run(&r);
+	CHECK((l.preempted == 0) && (l.result == PROFILE_PENDING), "no preemption: result %u", (unsigned)l.result);
+	
+	return TEST_DONE();
+}
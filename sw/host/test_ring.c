@@ -0,0 +1,113 @@
+// End to end test of the streaming core: every format and rate is streamed
+// through the ring buffer with the device clock off by +-100 ppm. The DMA
+// output must be the input, bit exact at unity gain, with no under- or
+// overruns, and the feedback must converge to the device rate.
+
+#include <stdint.h>
+#include <stdlib.h>
+#include "arm_math.h"
+#include "audio.h"
+#include "feedback.h"
+#include "sim.h"
+#include "test.h"
+
+#define RUN_MS	10000
+
+// Halfwords of silence the DMA reads before the first frame
+#ifdef AUDIO_PIPELINE
+#define LEAD	(3 + 2 * PIPE_LEN)
+#else
+#define LEAD	3
+#endif
+
+static const struct {
+	int		bits, fs;
+} formats[] = {
+	{24, 44100}, {24, 48000}, {24, 88200}, {24, 96000},
+	{16, 44100}, {16, 48000}, {16, 88200}, {16, 96000}, {16, 176400},
+	{32, 44100}, {32, 48000},
+};
+
+// The I2S halfwords of sample s after the alternate setting for bits has
+// cut it to its resolution
+static void expect(int bits, int32_t s, uint16_t *hw) {
+	
+	uint32_t	q = (uint32_t)s & (bits == 16 ? 0xffff0000 : 0xffffff00);
+	
+	hw[0] = q >> 16;
+	hw[1] = q & 0xff00;
+}
+
+static void checkOutput(int bits, const uint16_t *out, int n, const char *name) {
+	
+	int			i, bad = -1;
+	uint16_t	hw[2];
+	
+	for(i = 0; (i < n) && (i < LEAD); ++i)
+		if(out[i] != 0)
+			bad = i;
+	for(i = LEAD; (i < n) && (bad < 0); i += 2) {
+		expect(bits, SimSample((i - LEAD) / 4, ((i - LEAD) / 2) & 1), hw);
+		if((out[i] != hw[0]) || ((i + 1 < n) && (out[i + 1] != hw[1])))
+			bad = i;
+	}
+	CHECK(bad < 0, "%s: output differs at halfword %d", name, bad);
+}
+
+int main(void) {
+	
+	struct sim_stream	s = {0};
+	struct sim_stats	st;
+	unsigned			i;
+	int					ppm;
+	char				name[40];
+	
+	s.ms = RUN_MS;
+	for(i = 0; i < sizeof(formats) / sizeof(formats[0]); ++i)
+		for(ppm = -100; ppm <= 100; ppm += 200) {
+			s.bits = formats[i].bits;
+			s.fs = formats[i].fs;
+			s.ppm = ppm;
+			s.outLen = RUN_MS * 4 * (s.fs / 1000 + 1);
+			s.out = malloc(s.outLen * sizeof(uint16_t));
+			snprintf(name, sizeof(name), "%d bit %d Hz %+d ppm", s.bits, s.fs, ppm);
+	
+			CHECK(SimRun(&s, &st), "%s: not run", name);
+			checkOutput(s.bits, s.out, st.outCount, name);
+			CHECK(st.outCount > RUN_MS * 4 * (s.fs / 1000 - 1), "%s: %d halfwords played", name, st.outCount);
+			CHECK((st.underruns == 0) && (st.overruns == 0), "%s: %u underruns, %u overruns", name,
+				  (unsigned)st.underruns, (unsigned)st.overruns);
+			CHECK(st.settleMs < RUN_MS - 1000, "%s: fill settled after %d ms", name, st.settleMs);
+			CHECK((st.fillMin >= -FB_FILL_TOL) && (st.fillMax <= FB_FILL_TOL), "%s: fill %d..%d", name,
+				  st.fillMin, st.fillMax);
+			CHECK((st.fbPpm > -5) && (st.fbPpm < 5), "%s: feedback off by %.1f ppm", name, st.fbPpm);
+			free(s.out);
+		}
+	
+	// Shortest and longest latency that fit the buffer at each rate. The
+	// buffer must be twice the target fill level, and a longer latency is
+	// limited to the longest.
+	for(i = 0; i < sizeof(formats) / sizeof(formats[0]); ++i) {
+		s.bits = formats[i].bits;
+		s.fs = formats[i].fs;
+		s.ppm = 100;
+		s.out = 0;
+		for(s.latency = LATENCY_MS_MIN; s.latency <= LATENCY_MS_MAX(s.fs);
+			s.latency += LATENCY_MS_MAX(s.fs) - LATENCY_MS_MIN) {
+			snprintf(name, sizeof(name), "%d bit %d Hz %d ms", s.bits, s.fs, s.latency);
+			
+			CHECK(SimRun(&s, &st), "%s: not run", name);
+			CHECK(2 * AudioTarget(s.fs, s.latency) <= BUF_SIZE, "%s: buffer too long", name);
+			CHECK(AudioTarget(s.fs, s.latency) == 4 * s.latency * ((s.fs + 999) / 1000) + PIPE_HOLD, "%s: target fill %d", name,
+				  AudioTarget(s.fs, s.latency));
+			CHECK((st.underruns == 0) && (st.overruns == 0), "%s: %u underruns, %u overruns", name,
+				  (unsigned)st.underruns, (unsigned)st.overruns);
+			CHECK((st.fillMin >= -FB_FILL_TOL) && (st.fillMax <= FB_FILL_TOL), "%s: fill %d..%d", name,
+				  st.fillMin, st.fillMax);
+		}
+		CHECK(AudioTarget(s.fs, LATENCY_MS_MAX(s.fs) + 1) == AudioTarget(s.fs, LATENCY_MS_MAX(s.fs)),
+			  "%d Hz: latency beyond the buffer not limited", s.fs);
+	}
+	
+	return TEST_DONE();
+}
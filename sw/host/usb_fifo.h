@@ -0,0 +1,27 @@
+#ifndef USB_FIFO_H_
+#define	USB_FIFO_H_
+
+// Simulated USB RX FIFO for the host build, included from src/pcm.h. Every
+// read returns the next word of the packet loaded with FifoLoad, whatever
+// the address, like the OTG FIFO window.
+
+#include <stdint.h>
+
+const uint32_t		*fifoNext;
+volatile uint32_t	usbFifo;		// Address passed as the FIFO
+
+static inline void FifoLoad(const uint32_t *packet) {
+	
+	fifoNext = packet;
+}
+
+static inline uint32_t FifoRead(volatile uint32_t *fifo) {
+	
+	(void)fifo;
+	
+	return *fifoNext++;
+}
+
+#define PCM_READ(src)	FifoRead(src)
+
+#endif
@@ -3,10 +3,15 @@
 #include "usart.h"
 #endif
 #include "adc.h"
+#include "profile.h"
 
+// Averaging window per channel. DMA2 stream 0 fills the circular buffer
+// with interleaved channel 0 and 1 conversions, and each half/complete
+// transfer interrupt sums the half just written.
 #define	NSAMP	512
-volatile int	ch, samples[2][NSAMP], sPtr[2], sum[2];
-int				adcData[2];
+static volatile uint16_t	samples[2 * NSAMP];
+static int					sum[2][2];	// Per buffer half and channel
+int							adcData[2];
 
 void ADCInit(void) {
 	
@@ -47,15 +52,33 @@ void ADCInit(void) {
 	ADC1->CR2 &= ~ADC_CR2_EXTSEL;
 	ADC1->CR2 |= (8 << ADC_CR2_EXTSEL_Pos);
 	
-	// Enable ADC interrupt
-	ADC1->CR1 |= ADC_CR1_EOCIE;
+	// DMA request after each conversion, continued in circular mode
+	ADC1->CR2 &= ~ADC_CR2_EOCS;
+	ADC1->CR2 |= ADC_CR2_DMA | ADC_CR2_DDS;
 	
-	NVIC_SetPriority(ADC_IRQn, 0);
-	NVIC_EnableIRQ(ADC_IRQn);
-	
-	ch = 0;
 	adcData[0] = 0;
 	adcData[1] = 0;
+	sum[0][0] = sum[0][1] = sum[1][0] = sum[1][1] = 0;
+	
+	// DMA2 stream 0, channel 0 (ADC1)
+	RCC->AHB1ENR |= RCC_AHB1ENR_DMA2EN;
+	
+	DMA2_Stream0->CR &= ~DMA_SxCR_EN;
+	while(DMA2_Stream0->CR & DMA_SxCR_EN);
+	
+	DMA2_Stream0->PAR = (uint32_t)&(ADC1->DR);
+	DMA2_Stream0->M0AR = (uint32_t)samples;
+	DMA2_Stream0->NDTR = 2 * NSAMP;
+	
+	// Peripheral to memory, 16-bit, circular, half and full transfer interrupts
+	DMA2_Stream0->CR = (1 << DMA_SxCR_MSIZE_Pos) | (1 << DMA_SxCR_PSIZE_Pos) |
+	                   DMA_SxCR_MINC | DMA_SxCR_CIRC | DMA_SxCR_HTIE | DMA_SxCR_TCIE;
+	
+	DMA2->LIFCR = DMA_LIFCR_CTCIF0 | DMA_LIFCR_CHTIF0 | DMA_LIFCR_CTEIF0 | DMA_LIFCR_CDMEIF0 | DMA_LIFCR_CFEIF0;
+	DMA2_Stream0->CR |= DMA_SxCR_EN;
+	
+	// Below the USB and audio interrupts, see irq_prio.h
+	NVIC_EnableIRQ(DMA2_Stream0_IRQn);
 	
 	ADC1->CR2 |= ADC_CR2_SWSTART;
 	
@@ -73,22 +96,45 @@ void ADCInit(void) {
 	TIM3->CR1 |= TIM_CR1_CEN;
 }
 
-void ADC_IRQHandler(void) {
-
-	int		newVal = ADC1->DR;
-	
-	sum[ch] = sum[ch] - samples[ch][sPtr[ch]] + newVal;
-	samples[ch][sPtr[ch]] = newVal;
-	
-	sPtr[ch] = (sPtr[ch] + 1) % NSAMP;
-	
-	adcData[ch] = sum[ch] >> 9;
-
-	ch = (ch + 1) % 2;
+// Sum the half of the buffer that the DMA has just filled. The average
+// is over the last NSAMP conversions of each channel, updated every
+// NSAMP / 2.
+void DMA2_Stream0_IRQHandler(void) {
+	
+	uint32_t			flags = DMA2->LISR;
+	const uint16_t		*s;
+	int					half, i, s0 = 0, s1 = 0;
+	PROFILE_ENTER();
+	
+	if(flags & DMA_LISR_HTIF0) {
+		DMA2->LIFCR = DMA_LIFCR_CHTIF0;
+		half = 0;
+	}
+	else if(flags & DMA_LISR_TCIF0) {
+		DMA2->LIFCR = DMA_LIFCR_CTCIF0;
+		half = 1;
+	}
+	else {
+		DMA2->LIFCR = DMA_LIFCR_CTEIF0 | DMA_LIFCR_CDMEIF0 | DMA_LIFCR_CFEIF0;
+		PROFILE_EXIT(PROF_ADC);
+		return;
+	}
+	
+	s = (const uint16_t *)&samples[half * NSAMP];
+	for(i = 0; i < NSAMP; i += 2) {
+		s0 += s[i];
+		s1 += s[i + 1];
+	}
+	sum[half][0] = s0;
+	sum[half][1] = s1;
+	
+	adcData[0] = (sum[0][0] + sum[1][0]) >> 9;
+	adcData[1] = (sum[0][1] + sum[1][1]) >> 9;
 	
 #ifdef DEBUG
-//printMsg("ADC: %d\r\n", adcData[ch]);
+//printMsg("ADC: %d\r\n", adcData[0]);
 #endif
+	PROFILE_EXIT(PROF_ADC);
 }
 
 int ADCRead(int ch) {
@@ -1,8 +1,108 @@
 #include <stdint.h>
-#include <math.h>
 #include "arm_math.h"
 #include "stm32f4xx.h"
 #include "audio.h"
+#include "audio_hal.h"
+#include "profile.h"
+#include "i2s_pll.h"
+
+static int	latencyMs = LATENCY_MS;
+static int	currentFs = 96000; // Default rate until the host selects one
+static const struct i2s_pll *findPLL(int fs) {
+	
+	unsigned	i;
+	
+	for(i = 0; i < sizeof(i2s_pll_table) / sizeof(i2s_pll_table[0]); ++i)
+		if(i2s_pll_table[i].fs == fs)
+			return &i2s_pll_table[i];
+	
+	return 0;
+}
+
+// Program the I2S PLL and prescaler from a table entry, see tools/i2s_pll.py.
+// The I2S PLL must be disabled.
+// MCLK = I2S clock / (2 * I2SDIV + I2SODD) = 256 x fs
+static void setI2SClock(const struct i2s_pll *pll) {
+	
+	int		tmpReg;
+	
+	tmpReg = RCC->PLLI2SCFGR;
+	tmpReg &= ~RCC_PLLI2SCFGR_PLLI2SR;
+	tmpReg |= pll->r << RCC_PLLI2SCFGR_PLLI2SR_Pos;
+	
+	tmpReg &= ~RCC_PLLI2SCFGR_PLLI2SN;
+	tmpReg |= pll->n << RCC_PLLI2SCFGR_PLLI2SN_Pos;
+	
+	tmpReg &= ~RCC_PLLI2SCFGR_PLLI2SM;
+	tmpReg |= pll->m << RCC_PLLI2SCFGR_PLLI2SM_Pos;
+	RCC->PLLI2SCFGR = tmpReg;
+	
+	tmpReg = SPI2->I2SPR;
+	if(pll->odd)
+		tmpReg |= SPI_I2SPR_ODD;
+	else
+		tmpReg &= ~SPI_I2SPR_ODD;
+	
+	tmpReg &= ~SPI_I2SPR_I2SDIV;
+	tmpReg |= pll->div << SPI_I2SPR_I2SDIV_Pos;
+	SPI2->I2SPR = tmpReg;
+}
+
+// Nominal feedback value in 10.14 format for the actual sampling frequency
+// the I2S clock generates for fs, or 0 if fs is not supported.
+uint32_t AudioDefaultFeedback(int fs) {
+	
+	const struct i2s_pll	*pll = findPLL(fs);
+	
+	return pll ? pll->fb : 0;
+}
+
+// Set the target fill level and active buffer length for the sampling
+// frequency fs. The DMA must be disabled.
+static void setBufferLength(int fs) {
+	
+	int		target = AudioTarget(fs, latencyMs);
+	
+	audio_status.target = target;
+	audio_status.bufLen = 2 * target;
+#ifdef AUDIO_PIPELINE
+	DMA1_Stream4->NDTR = PIPE_LEN;
+#else
+	DMA1_Stream4->NDTR = audio_status.bufLen;
+#endif
+}
+
+#ifdef AUDIO_PIPELINE
+// Silence both DMA blocks and start with block 0. The DMA must be disabled.
+static void resetBlocks(void) {
+	
+	int		i;
+	
+	for(i = 0; i < PIPE_LEN; ++i)
+		audio_block[0][i] = audio_block[1][i] = 0;
+	
+	DMA1_Stream4->CR &= ~DMA_SxCR_CT;
+}
+#endif
+
+// Select the latency in ms, LATENCY_MS_MIN up to what fits BUF_SIZE at the
+// current rate. Takes effect the next time audio is enabled. A later switch
+// to a higher rate shortens it to what fits there.
+int AudioSetLatency(int ms) {
+	
+	if((ms < LATENCY_MS_MIN) || (ms > LATENCY_MS_MAX(currentFs)))
+		return 0;
+	
+	latencyMs = ms;
+	
+	return 1;
+}
+
+// The latency in ms in effect at the current rate
+int AudioGetLatency(void) {
+	
+	return latencyMs < LATENCY_MS_MAX(currentFs) ? latencyMs : LATENCY_MS_MAX(currentFs);
+}
 
 void AudioInit(void) {
 
@@ -11,6 +111,11 @@ void AudioInit(void) {
 	audio_status.writePtr = 3; // Not working...
 	audio_status.readPtr = 0;
 	audio_status.diff = 0;
+	audio_status.written = audio_status.writePtr;
+	audio_status.consumed = 0;
+	audio_status.dmaHalf = 0;
+	audio_status.underruns = 0;
+	audio_status.overruns = 0;
 	
 	for(i = 0; i < BUF_SIZE; ++i)
 		audio_buffer[i] = 0;
@@ -44,15 +149,16 @@ void AudioInit(void) {
 	SPI2->I2SCFGR = tmpReg;
 	
 	// I2S master clock output enable
-	tmpReg = SPI2->I2SPR;
-	tmpReg |= SPI_I2SPR_MCKOE;
+	SPI2->I2SPR |= SPI_I2SPR_MCKOE;
 	
-	tmpReg |= SPI_I2SPR_ODD;
+	// I2S PLL and prescaler for the default sampling frequency
+	RCC->CR &= ~RCC_CR_PLLI2SON;
+	while(RCC->CR & RCC_CR_PLLI2SRDY);
 	
-	// Linear prescaler value set to 3
-	tmpReg &= ~SPI_I2SPR_I2SDIV;
-	tmpReg |= 3 << SPI_I2SPR_I2SDIV_Pos;
-	SPI2->I2SPR = tmpReg;
+	setI2SClock(findPLL(currentFs));
+	
+	RCC->CR |= RCC_CR_PLLI2SON;
+	while(!(RCC->CR & RCC_CR_PLLI2SRDY));
 	
 	SPI2->CR2 |= SPI_CR2_TXDMAEN; 
 	
@@ -66,10 +172,15 @@ void AudioInit(void) {
 	DMA1_Stream4->PAR = (uint32_t)&(SPI2->DR);
 	
 	// Memory address
+#ifdef AUDIO_PIPELINE
+	DMA1_Stream4->M0AR = (uint32_t)audio_block[0];
+	DMA1_Stream4->M1AR = (uint32_t)audio_block[1];
+#else
 	DMA1_Stream4->M0AR = (uint32_t)audio_buffer;
+#endif
 	
 	// Total number of data items to be transferred
-	DMA1_Stream4->NDTR = BUF_SIZE;
+	setBufferLength(currentFs);
 	
 	tmpReg = DMA1_Stream4->CR;
 	
@@ -84,13 +195,26 @@ void AudioInit(void) {
 	tmpReg &= ~DMA_SxCR_PL;
 	tmpReg |= 3 << DMA_SxCR_PL_Pos; // Highest priority
 	
-	tmpReg &= ~DMA_SxCR_MBURST; // Single memory transfer
+	tmpReg &= ~DMA_SxCR_MBURST;
+#ifdef AUDIO_DMA_FIFO
+	tmpReg |= 1 << DMA_SxCR_MBURST_Pos; // Memory bursts of four words
+#endif
 	tmpReg &= ~DMA_SxCR_PBURST; // Single peripheral transfer
+#ifdef AUDIO_PIPELINE
+	tmpReg |= DMA_SxCR_DBM; // Double buffer, switch block on each transfer complete
+	tmpReg &= ~DMA_SxCR_CT;
+#else
 	tmpReg &= ~DMA_SxCR_DBM; // No double buffer
+#endif
 	tmpReg &= ~DMA_SxCR_PINCOS;
 	
+	// 32-bit memory reads with the FIFO, each unpacked into two halfwords
 	tmpReg &= ~DMA_SxCR_MSIZE;
+#ifdef AUDIO_DMA_FIFO
+	tmpReg |= 2 << DMA_SxCR_MSIZE_Pos;
+#else
 	tmpReg |= 1 << DMA_SxCR_MSIZE_Pos;
+#endif
 	
 	tmpReg &= ~DMA_SxCR_PSIZE;
 	tmpReg |= 1 << DMA_SxCR_PSIZE_Pos;
@@ -99,8 +223,26 @@ void AudioInit(void) {
 	tmpReg &= ~DMA_SxCR_PINC;
 	tmpReg |= DMA_SxCR_CIRC;
 	
+#ifdef AUDIO_PIPELINE
+	// Transfer complete interrupt at each block switch
+	tmpReg &= ~DMA_SxCR_HTIE;
+	tmpReg |= DMA_SxCR_TCIE;
+#else
+	// Half and full transfer interrupts keep track of consumed samples
+	tmpReg |= DMA_SxCR_HTIE | DMA_SxCR_TCIE;
+#endif
+	
 	DMA1_Stream4->CR = tmpReg;
 	
+#ifdef AUDIO_DMA_FIFO
+	// FIFO mode with full threshold, refilled by one burst of eight
+	// halfwords. NDTR must be a multiple of eight halfwords, which holds
+	// since the buffer length is twice a whole number of frames.
+	DMA1_Stream4->FCR = DMA_SxFCR_DMDIS | (3 << DMA_SxFCR_FTH_Pos);
+#else
+	DMA1_Stream4->FCR &= ~DMA_SxFCR_DMDIS; // Direct mode
+#endif
+	
 	// Enable DMA and then disable it in order to flush all FIFOs etc
 	DMA1->HIFCR |= (DMA_HIFCR_CTCIF4 | DMA_HIFCR_CHTIF4 | DMA_HIFCR_CTEIF4 | DMA_HIFCR_CDMEIF4 | DMA_HIFCR_CFEIF4);
 	DMA1_Stream4->CR |= DMA_SxCR_EN;
@@ -109,11 +251,15 @@ void AudioInit(void) {
 	DMA1_Stream4->CR &= ~DMA_SxCR_EN;
 	while(DMA1_Stream4->CR & DMA_SxCR_EN);
 	
+	NVIC_EnableIRQ(DMA1_Stream4_IRQn);
 }
 
 int AudioReconfigure(int fs) {
 	
-	int		tmpReg;
+	const struct i2s_pll	*pll = findPLL(fs);
+	
+	if(!pll)
+		return 0;
 	
 	// Disable DMA
 	DMA1_Stream4->CR &= ~DMA_SxCR_EN;
@@ -128,71 +274,10 @@ int AudioReconfigure(int fs) {
 	while(RCC->CR & RCC_CR_PLLI2SRDY);
 	
 	// Reconfigure PLL for chosen sampling frequency
-	switch(fs) {
-		case 44100:
-		case 88200:
-			// Set I2S PLL dividers to:
-			// M = 25, N = 271, R = 2 for 44.1 kHz and 88.2 kHz
-			// This gives an I2S clock of  25 MHz / 25 * 271 / 2 = 135.5 MHz
-			// and a sampling frequency of fs = 44.108 kHz when I2SDIV = 3 and I2SODD = 0
-			// and fs = 88.216 kHz when I2SDIV = 3 and I2SODD = 0
-			// In this case, MCLK = I2S clock / (2 * I2SDIV + I2SODD)
-			// MCLK is 256xfs
-			tmpReg = RCC->PLLI2SCFGR;
-			tmpReg &= ~RCC_PLLI2SCFGR_PLLI2SR;
-			tmpReg |= 2 << RCC_PLLI2SCFGR_PLLI2SR_Pos;
-	
-			tmpReg &= ~RCC_PLLI2SCFGR_PLLI2SN;
-			tmpReg |= 271 << RCC_PLLI2SCFGR_PLLI2SN_Pos;
-		
-			tmpReg &= ~RCC_PLLI2SCFGR_PLLI2SM;
-			tmpReg |= 25 << RCC_PLLI2SCFGR_PLLI2SM_Pos;
-			RCC->PLLI2SCFGR = tmpReg;
-			
-			tmpReg = SPI2->I2SPR;
-			tmpReg &= ~SPI_I2SPR_ODD;
-	
-			tmpReg &= ~SPI_I2SPR_I2SDIV;
-			if(fs == 44100)
-				tmpReg |= 6 << SPI_I2SPR_I2SDIV_Pos;
-			else
-				tmpReg |= 3 << SPI_I2SPR_I2SDIV_Pos;
-			SPI2->I2SPR = tmpReg;
-			break;
-		case 48000:
-		case 96000:
-			// Set I2S PLL dividers to:
-			// M = 25, N = 344, R = 2 for 96 kHz and
-			// M = 25, N = 172, R = 2 for 48 kHz
-			// This gives an I2S clock of  25 MHz / 25 * 344 / 2 = 172 MHz for 96 kHz
-			// and 25 MHz / 25 * 172 / 2 = 86 MHz for 48 kHz
-			// and a sampling frequency of fs = 95.982 (47.991) kHz when I2SDIV = 3 and I2SODD = 1
-			// In this case, MCLK = I2S clock / (2 * I2SDIV + I2SODD)
-			// MCLK is 256xfs
-			tmpReg = RCC->PLLI2SCFGR;
-			tmpReg &= ~RCC_PLLI2SCFGR_PLLI2SR;
-			tmpReg |= 2 << RCC_PLLI2SCFGR_PLLI2SR_Pos;
-	
-			tmpReg &= ~RCC_PLLI2SCFGR_PLLI2SN;
-			if(fs == 48000)
-				tmpReg |= 172 << RCC_PLLI2SCFGR_PLLI2SN_Pos;
-			else
-				tmpReg |= 344 << RCC_PLLI2SCFGR_PLLI2SN_Pos;
-	
-			tmpReg &= ~RCC_PLLI2SCFGR_PLLI2SM;
-			tmpReg |= 25 << RCC_PLLI2SCFGR_PLLI2SM_Pos;
-			RCC->PLLI2SCFGR = tmpReg;
-			
-			tmpReg = SPI2->I2SPR;
-			tmpReg |= SPI_I2SPR_ODD;
-	
-			tmpReg &= ~SPI_I2SPR_I2SDIV;
-			tmpReg |= 3 << SPI_I2SPR_I2SDIV_Pos;
-			SPI2->I2SPR = tmpReg;
-			break;
-		default:
-			;
-	}
+	setI2SClock(pll);
+	
+	currentFs = fs;
+	setBufferLength(currentFs);
 	
 	DMA1->HIFCR |= (DMA_HIFCR_CTCIF4 | DMA_HIFCR_CHTIF4 | DMA_HIFCR_CTEIF4 | DMA_HIFCR_CDMEIF4 | DMA_HIFCR_CFEIF4);
 	DMA1_Stream4->CR |= DMA_SxCR_EN;
@@ -209,11 +294,19 @@ void EnableAudio(void) {
 	audio_status.writePtr = 3;
 	audio_status.readPtr = 0;
 	audio_status.diff = 0;
+	audio_status.written = audio_status.writePtr;
+	audio_status.consumed = 0;
+	audio_status.dmaHalf = 0;
 	
 	// Reset and enable DMA memory
 	DMA1_Stream4->CR &= ~DMA_SxCR_EN;
 	while(DMA1_Stream4->CR & DMA_SxCR_EN);
 	
+	setBufferLength(currentFs);
+#ifdef AUDIO_PIPELINE
+	resetBlocks();
+#endif
+	
 	DMA1->HIFCR |= (DMA_HIFCR_CTCIF4 | DMA_HIFCR_CHTIF4 | DMA_HIFCR_CTEIF4 | DMA_HIFCR_CDMEIF4 | DMA_HIFCR_CFEIF4);
 	DMA1_Stream4->CR |= DMA_SxCR_EN;
 	while(!(DMA1_Stream4->CR & DMA_SxCR_EN));
@@ -234,4 +327,30 @@ void DisableAudio(void) {
 	
 	for(i = 0; i < BUF_SIZE; ++i)
 		audio_buffer[i] = 0;
-}
\ No newline at end of file
+#ifdef AUDIO_PIPELINE
+	resetBlocks();
+#endif
+}
+
+void DMA1_Stream4_IRQHandler(void) {
+	
+	uint32_t	flags = DMA1->HISR;
+	PROFILE_ENTER();
+	
+#ifdef AUDIO_PIPELINE
+	if(flags & DMA_HISR_TCIF4) {
+		DMA1->HIFCR = DMA_HIFCR_CTCIF4;
+		AudioBlockSwap(AudioHalTarget());
+	}
+#else
+	if(flags & DMA_HISR_HTIF4) {
+		DMA1->HIFCR = DMA_HIFCR_CHTIF4;
+		AudioHalfTransfer(1);
+	}
+	if(flags & DMA_HISR_TCIF4) {
+		DMA1->HIFCR = DMA_HIFCR_CTCIF4;
+		AudioHalfTransfer(0);
+	}
+#endif
+	PROFILE_EXIT(PROF_DMA);
+}
@@ -6,25 +6,97 @@
 #define SAMPLES48000	48
 #define SAMPLES88200	88
 #define SAMPLES96000	96
+#define SAMPLES176400	176
+
+// Largest packet, one extra frame for rate adaptation. 176.4 kHz is only
+// available with 16-bit samples
+#define MAX_PACKET_FRAMES	(SAMPLES176400 + 1)
 
 // Ratio to increase write buffer beyond what is absolutely needed
 #define BUF_MARGIN		8
 
 // Size of write buffer as number of 16-bit integers
-#define BUF_SIZE		(4 * SAMPLES96000 * BUF_MARGIN)
+#define BUF_SIZE		(4 * MAX_PACKET_FRAMES * BUF_MARGIN)
+
+// With AUDIO_PIPELINE the ring buffer is a staging FIFO. The DMA plays two
+// blocks of PIPE_FRAMES frames in double buffer mode and AudioBlockSwap
+// refills and processes the idle block from the DMA interrupt.
+#ifdef AUDIO_PIPELINE
+#ifndef PIPE_FRAMES
+#define PIPE_FRAMES		32
+#endif
+#define PIPE_LEN		(4 * PIPE_FRAMES)	// Block length as number of 16-bit integers
+#if defined(AUDIO_DMA_FIFO) && (PIPE_FRAMES % 2)
+#error "PIPE_FRAMES must be even for DMA bursts"
+#endif
+// The fill level counts the blocks as not yet read. The target adds them
+// on top of the latency, so the ring buffer still holds the latency.
+#define PIPE_HOLD		(2 * PIPE_LEN)
+#else
+#define PIPE_HOLD		0
+#endif
+
+// Latency in ms, i.e. the target buffer fill level. The active buffer length
+// is twice the target fill level, limited by BUF_SIZE
+#ifndef LATENCY_MS
+#define LATENCY_MS		4
+#endif
+#define LATENCY_MS_MIN	2
+// Longest latency whose buffer fits BUF_SIZE at fs, in whole frames per ms
+#define LATENCY_MS_MAX(fs)	((BUF_SIZE / 2 - PIPE_HOLD) / (4 * (((fs) + 999) / 1000)))
+#if LATENCY_MS > LATENCY_MS_MAX(44100)
+#error "LATENCY_MS does not fit BUF_SIZE at 44.1 kHz"
+#endif
+
+// Volume range and step in 1/256 dB. VOLUME_SILENCE is minus infinity
+#define VOLUME_MIN		(-96 * 256)
+#define VOLUME_MAX		0
+#define VOLUME_RES		128
+#define VOLUME_SILENCE	(-32768)
+
+// Length of the soft mute ramps around a sampling frequency switch
+#define FADE_MS			2
+#define FADE_FRAMES(fs)	(FADE_MS * (((fs) + 999) / 1000))
 
 struct audio_stat {
-	int		writePtr;
-	int		readPtr;
-	int		diff;
+	int			writePtr;
+	int			readPtr;
+	int			diff;
+	int			bufLen;		// Active buffer length as number of 16-bit integers
+	int			target;		// Target fill level as number of 16-bit integers
+	uint32_t	written;	// Halfwords written to the buffer since the stream started
+	uint32_t	consumed;	// Halfwords read by the DMA up to its last half/full transfer,
+							// or moved to the DMA blocks with AUDIO_PIPELINE
+	int			dmaHalf;	// DMA is in the second half of the buffer, or the block
+							// it reads with AUDIO_PIPELINE
+	uint32_t	underruns;	// DMA read data that had not been written
+	uint32_t	overruns;	// Write overtook data not yet read by the DMA
 };
 
-volatile uint16_t 			audio_buffer[BUF_SIZE]; // Allocate memory for write buffer
+volatile uint16_t 			audio_buffer[BUF_SIZE] __attribute__((aligned(16))); // Allocate memory for write buffer, aligned for DMA bursts
 volatile struct audio_stat	audio_status;
+#ifdef AUDIO_PIPELINE
+volatile uint16_t			audio_block[2][PIPE_LEN] __attribute__((aligned(16))); // DMA double buffer
+#endif
 
 void AudioInit(void);
 int AudioReconfigure(int fs);
+uint32_t AudioDefaultFeedback(int fs);
 void EnableAudio(void);
 void DisableAudio(void);
+void AudioWrite24(volatile uint32_t *src, int nFrames);
+void AudioWrite16(volatile uint32_t *src, int nFrames);
+void AudioWrite32(volatile uint32_t *src, int nFrames);
+void AudioWriteSilence(int nFrames);
+void AudioFadeOut(int nFrames);
+void AudioFadeIn(int nFrames);
+void AudioSetVolume(int volume);
+int AudioTarget(int fs, int ms);
+uint32_t AudioConsumed(void);
+int AudioFill(void);
+void AudioHalfTransfer(int second);
+void AudioBlockSwap(int target);
+int AudioSetLatency(int ms);
+int AudioGetLatency(void);
 
 #endif
\ No newline at end of file
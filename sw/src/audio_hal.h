@@ -0,0 +1,34 @@
+#ifndef AUDIO_HAL_H_
+#define	AUDIO_HAL_H_
+
+// Hardware access for the ring buffer code in audio_ring.c. Only the
+// DMA position and the stream state are needed, so a simulated consumer
+// can stand in for the I2S DMA. The host build in sw/host defines
+// AUDIO_HOST and uses its simulated DMA instead.
+
+#ifdef AUDIO_HOST
+#include "../host/audio_hal.h"
+#else
+#include "stm32f4xx.h"
+
+// Halfwords left until the DMA wraps to the start of the buffer, or to
+// the other block in double buffer mode
+static inline int AudioHalRemaining(void) {
+	
+	return DMA1_Stream4->NDTR & 0xffff;
+}
+
+// Block the DMA reads in double buffer mode
+static inline int AudioHalTarget(void) {
+	
+	return (DMA1_Stream4->CR & DMA_SxCR_CT) ? 1 : 0;
+}
+
+// The DMA is enabled and the I2S is clocking out data
+static inline int AudioHalStreaming(void) {
+	
+	return (DMA1_Stream4->CR & DMA_SxCR_EN) && (SPI2->I2SCFGR & SPI_I2SCFGR_I2SE);
+}
+#endif
+
+#endif
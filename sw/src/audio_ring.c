@@ -0,0 +1,477 @@
+// Ring buffer between the USB packet ingest and the I2S DMA: write and
+// read accounting, volume, requantization and soft mute ramps. Hardware
+// access goes through audio_hal.h.
+//
+// With AUDIO_PIPELINE the USB side only unpacks into the ring buffer and
+// the block processor in AudioBlockSwap applies volume and requantization
+// to fixed blocks on their way to the DMA.
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "arm_math.h"
+#include "pcm.h"
+#include "audio.h"
+#include "audio_hal.h"
+#include "meter.h"
+
+#ifdef DIGITAL_METER
+#define METERING	1
+#else
+#define METERING	0
+#endif
+
+static int	fadeLen = 0, fadeFrames = 0; // Fade in ramp length and progress in frames
+
+// Digital volume. gainTarget is set by AudioSetVolume, gain follows it
+// per packet. The Q31 path is only used when the gain is not unity.
+#define GAIN_UNITY	0x7fffffff
+static volatile q31_t	gainTarget = GAIN_UNITY;
+static q31_t			gain = GAIN_UNITY;
+#ifdef AUDIO_PIPELINE
+static q31_t			pipe[2 * PIPE_FRAMES];
+#else
+static q31_t			block[2 * MAX_PACKET_FRAMES]; // ept1_rx limits packets to EP_SIZE
+#endif
+
+// Frames between the DMA read position and the start of the fade out ramp.
+// The block processor may take one more block, plus a straddling frame.
+#ifdef AUDIO_PIPELINE
+#define FADE_GUARD	(16 + PIPE_FRAMES + 1)
+#else
+#define FADE_GUARD	16
+#endif
+
+static inline int gainActive(void) {
+	
+	return (gain != GAIN_UNITY) || (gainTarget != GAIN_UNITY);
+}
+
+// Resynchronize the written count with the pointer distance after the
+// write and read positions have lost track of each other
+static void resync(uint32_t consumed, int readPtr) {
+	
+	int		d = audio_status.writePtr - readPtr;
+	
+	audio_status.written = consumed + (d < 0 ? d + audio_status.bufLen : d);
+}
+
+#ifdef AUDIO_PIPELINE
+// Number of halfwords played since the stream started. The block being
+// read was taken from the ring buffer before the one queued after it,
+// unless the switch to the queued block is still pending. A block of
+// silence after an underrun is counted as data until the next switch.
+uint32_t AudioConsumed(void) {
+	
+	uint32_t	consumed, ndtr;
+	int			target;
+	
+	do {
+		consumed = audio_status.consumed;
+		target = AudioHalTarget();
+		ndtr = AudioHalRemaining();
+	} while(consumed != audio_status.consumed);
+	
+	return consumed - ndtr - (target == audio_status.dmaHalf ? PIPE_LEN : 0);
+}
+
+// Number of halfwords taken from the ring buffer by the block processor
+static uint32_t readCount(void) {
+	
+	return audio_status.consumed;
+}
+#else
+// Number of halfwords read by the DMA since the stream started. Exact to
+// the current DMA position, not just the last half/full transfer.
+uint32_t AudioConsumed(void) {
+	
+	uint32_t	consumed, ndtr;
+	int			half, pos, len = audio_status.bufLen;
+	
+	// Retry if a half/full transfer interrupt came in between
+	do {
+		consumed = audio_status.consumed;
+		half = audio_status.dmaHalf;
+		ndtr = AudioHalRemaining();
+	} while(consumed != audio_status.consumed);
+	
+	pos = len - ndtr - (half ? len / 2 : 0);
+	
+	// The transfer interrupt may still be pending when the DMA wraps
+	if(pos < 0)
+		pos += len;
+	
+	audio_status.readPtr = len - ndtr;
+	
+	return consumed + pos;
+}
+
+static uint32_t readCount(void) {
+	
+	return AudioConsumed();
+}
+#endif
+
+// Target fill level in halfwords for ms of latency at fs, with ms limited
+// to what fits BUF_SIZE there. Whole stereo frames, rounded up to cover
+// the longer packets at 44.1 and 88.2 kHz, and the DMA blocks with
+// AUDIO_PIPELINE.
+int AudioTarget(int fs, int ms) {
+	
+	if(ms > LATENCY_MS_MAX(fs))
+		ms = LATENCY_MS_MAX(fs);
+	
+	return 4 * ms * ((fs + 999) / 1000) + PIPE_HOLD;
+}
+
+// Number of halfwords written but not yet read by the DMA
+int AudioFill(void) {
+	
+	return (int)(audio_status.written - AudioConsumed());
+}
+
+// More than a full buffer ahead of the DMA means unread data was overwritten
+static void checkOverrun(void) {
+	
+	uint32_t	consumed;
+	
+	if(!AudioHalStreaming())
+		return;
+	
+	consumed = readCount();
+	if((int)(audio_status.written - consumed) > audio_status.bufLen) {
+		audio_status.overruns++;
+		resync(consumed, audio_status.readPtr);
+	}
+}
+
+// Called from the DMA interrupt each time the DMA has read half of the
+// buffer. second is set when it continues into the second half.
+void AudioHalfTransfer(int second) {
+	
+	int		half = audio_status.bufLen / 2;
+	
+	audio_status.consumed += half;
+	audio_status.dmaHalf = second;
+	
+	// The DMA has read past the last written sample
+	if((int)(audio_status.written - audio_status.consumed) < 0) {
+		audio_status.underruns++;
+		resync(audio_status.consumed, second ? half : 0);
+	}
+}
+
+// Scale nFrames ring buffer frames, starting at halfword index pos, by a
+// linear gain ramp. The gain starts at g and changes by step per frame,
+// both in Q15.
+static void rampFrames(int pos, int nFrames, int g, int step) {
+	
+	int		len = audio_status.bufLen, lo, i, s;
+	
+	while(nFrames-- > 0) {
+		for(i = 0; i < 2; ++i) {
+			// A sample may straddle the end of the buffer
+			lo = pos + 1 == len ? 0 : pos + 1;
+			s = ((int16_t)audio_buffer[pos] << 8) | (audio_buffer[lo] >> 8);
+			s = (int32_t)(((int64_t)s * g) >> 15);
+			audio_buffer[pos] = s >> 8;
+			audio_buffer[lo] = (s & 0xff) << 8;
+			pos = lo + 1 == len ? 0 : lo + 1;
+		}
+		g += step;
+	}
+}
+
+// Ramp down nFrames of the buffered audio just ahead of the DMA and
+// silence the rest.
+// Returns once the ramp has been played. Writing must be stopped.
+void AudioFadeOut(int nFrames) {
+	
+	int			len = audio_status.bufLen, n = nFrames, fill, pos;
+	uint32_t	end;
+	
+	if(!AudioHalStreaming())
+		return;
+	
+	fill = (int)(audio_status.written - readCount()) / 4 - FADE_GUARD;
+	if(fill <= 0)
+		return;
+	
+	if(n > fill)
+		n = fill;
+	
+	// The write pointer is always at a frame boundary
+	pos = audio_status.writePtr - 4 * fill;
+	if(pos < 0)
+		pos += len;
+	
+	rampFrames(pos, n, 32767, -(32767 / n));
+	rampFrames((pos + 4 * n) % len, fill - n, 0, 0);
+	
+	end = audio_status.written - 4 * (fill - n);
+	while(((int)(end - AudioConsumed()) > 0) && AudioHalStreaming());
+}
+
+// Ramp up the first nFrames written from now on
+void AudioFadeIn(int nFrames) {
+	
+	fadeFrames = 0;
+	fadeLen = nFrames;
+}
+
+// Set the volume in 1/256 dB
+void AudioSetVolume(int volume) {
+	
+	if(volume == VOLUME_SILENCE)
+		gainTarget = 0;
+	else if(volume >= 0)
+		gainTarget = GAIN_UNITY;
+	else
+		gainTarget = (q31_t)(powf(10.0f, volume / (20.0f * 256.0f)) * 2147483648.0f);
+}
+
+// Apply the gain to a block of nFrames stereo frames. A new target gain is
+// approached by a quarter of the remaining distance per packet, with a
+// linear ramp across the packet so that there are no steps.
+static void applyGain(q31_t *buf, int nFrames) {
+	
+	q31_t	target = gainTarget, g = gain, next, step;
+	int		i;
+	
+	// A zero-length packet leaves the ramp where it is
+	if(nFrames <= 0)
+		return;
+	
+	if(g == target) {
+		arm_scale_q31(buf, g, 0, buf, 2 * nFrames);
+		return;
+	}
+	
+	next = g + (target - g) / 4;
+	if(abs(target - next) < (1 << 16))
+		next = target;
+	step = (next - g) / nFrames;
+	
+	for(i = 0; i < nFrames; ++i) {
+		g += step;
+		buf[2 * i] = (q31_t)(((q63_t)buf[2 * i] * g) >> 31);
+		buf[2 * i + 1] = (q31_t)(((q63_t)buf[2 * i + 1] * g) >> 31);
+	}
+	gain = next;
+}
+
+// Volume, metering and requantization of a Q31 block. Returns 0 if the
+// block is unchanged, since samples that were not scaled are not dithered.
+static int processBlock(q31_t *buf, int nFrames) {
+	
+	int		scaled = gainActive();
+	
+	if(scaled)
+		applyGain(buf, nFrames);
+#ifdef DIGITAL_METER
+	MeterBlock(buf, nFrames);
+#endif
+	if(scaled)
+		PCMRequantize24(buf, nFrames);
+	
+	return scaled;
+}
+
+// Write nFrames of a Q31 block to the ring buffer from halfword index wp,
+// wrapping at the end. Returns the new write index.
+static int writeBlock(int wp, const q31_t *buf, int nFrames) {
+	
+	int			len = audio_status.bufLen, n, i;
+	uint16_t	tmp[4];
+	
+	while(nFrames > 0) {
+		n = (len - wp) / 4;
+		if(n > nFrames)
+			n = nFrames;
+		PCMPack24((uint16_t *)&audio_buffer[wp], buf, n);
+		wp += n * 4;
+		buf += n * 2;
+		nFrames -= n;
+		if(wp == len)
+			wp = 0;
+		
+		// The frame that straddles the end of the buffer
+		if(nFrames && (wp > len - 4)) {
+			PCMPack24(tmp, buf, 1);
+			for(i = 0; i < 4; ++i) {
+				audio_buffer[wp] = tmp[i];
+				if(++wp == len)
+					wp = 0;
+			}
+			buf += 2;
+			nFrames--;
+		}
+	}
+	
+	return wp;
+}
+
+typedef void (*unpack_fn)(uint16_t *dst, volatile uint32_t *src, int nFrames);
+typedef void (*decode_fn)(q31_t *dst, volatile uint32_t *src, int nFrames);
+
+// Write nFrames stereo frames from the word stream src to the ring buffer
+// and advance the write pointer. The data is written in at most two linear
+// runs, one up to the end of the buffer and one from the start. Only the
+// pair of frames that straddles the end goes through a small scratch
+// buffer. Runs are whole pairs of frames, since the 24-bit kernel reads
+// three words per two frames.
+static void writeFrames(volatile uint32_t *src, int nFrames, unpack_fn unpack, decode_fn decode) {
+	
+	int			wp = audio_status.writePtr, len = audio_status.bufLen, n, i, total = nFrames;
+	int			start = wp;
+	uint16_t	tmp[8];
+	
+	n = (len - wp) / 4;
+#ifndef AUDIO_PIPELINE
+	if(METERING || gainActive()) {
+		// Volume below 0 dB and the meter go through a Q31 block
+		decode(block, src, nFrames);
+		processBlock(block, nFrames);
+		wp = writeBlock(wp, block, nFrames);
+	}
+	else
+#endif
+	if(nFrames <= n) {
+		unpack((uint16_t *)&audio_buffer[wp], src, nFrames);
+		wp += nFrames * 4;
+	}
+	else {
+		// Whole pairs of frames up to the end of the buffer
+		n &= ~1;
+		unpack((uint16_t *)&audio_buffer[wp], src, n);
+		wp += n * 4;
+		nFrames -= n;
+		
+		n = nFrames < 2 ? nFrames : 2;
+		unpack(tmp, src, n);
+		for(i = 0; i < n * 4; ++i) {
+			audio_buffer[wp] = tmp[i];
+			if(++wp == len)
+				wp = 0;
+		}
+		nFrames -= n;
+		
+		unpack((uint16_t *)&audio_buffer[wp], src, nFrames);
+		wp += nFrames * 4;
+	}
+	
+	// Soft start after a sampling frequency switch
+	if(fadeFrames < fadeLen) {
+		n = total < fadeLen - fadeFrames ? total : fadeLen - fadeFrames;
+		rampFrames(start, n, fadeFrames * 32767 / fadeLen, 32767 / fadeLen);
+		fadeFrames += n;
+	}
+	
+	audio_status.writePtr = wp == len ? 0 : wp;
+	audio_status.written += total * 4;
+	checkOverrun();
+}
+
+void AudioWrite24(volatile uint32_t *src, int nFrames) {
+	
+	writeFrames(src, nFrames, PCMUnpack24, PCMDecode24);
+}
+
+void AudioWrite16(volatile uint32_t *src, int nFrames) {
+	
+	writeFrames(src, nFrames, PCMUnpack16, PCMDecode16);
+}
+
+void AudioWrite32(volatile uint32_t *src, int nFrames) {
+	
+	writeFrames(src, nFrames, PCMUnpack32, PCMDecode32);
+}
+
+// Write nFrames of silence to the ring buffer and advance the write pointer
+void AudioWriteSilence(int nFrames) {
+	
+	int		wp = audio_status.writePtr, len = audio_status.bufLen, n;
+	
+	n = nFrames * 4;
+	if(n > len - wp) {
+		memset((uint16_t *)&audio_buffer[wp], 0, (len - wp) * 2);
+		n -= len - wp;
+		wp = 0;
+	}
+	memset((uint16_t *)&audio_buffer[wp], 0, n * 2);
+	wp += n;
+	
+	audio_status.writePtr = wp == len ? 0 : wp;
+	audio_status.written += nFrames * 4;
+	checkOverrun();
+}
+
+#ifdef AUDIO_PIPELINE
+// Read nFrames from the ring buffer from halfword index rp into a Q31
+// block, wrapping at the end. The inverse of writeBlock.
+static void readBlock(int rp, q31_t *buf, int nFrames) {
+	
+	int			len = audio_status.bufLen, n, i;
+	uint16_t	tmp[4];
+	
+	while(nFrames > 0) {
+		n = (len - rp) / 4;
+		if(n > nFrames)
+			n = nFrames;
+		PCMDecodeI2S(buf, (uint16_t *)&audio_buffer[rp], n);
+		rp += n * 4;
+		buf += n * 2;
+		nFrames -= n;
+		if(rp == len)
+			rp = 0;
+		
+		// The frame that straddles the end of the buffer
+		if(nFrames && (rp > len - 4)) {
+			for(i = 0; i < 4; ++i) {
+				tmp[i] = audio_buffer[rp];
+				if(++rp == len)
+					rp = 0;
+			}
+			PCMDecodeI2S(buf, tmp, 1);
+			buf += 2;
+			nFrames--;
+		}
+	}
+}
+
+// Block processor, called from the DMA interrupt when the DMA has switched
+// to block target. The next PIPE_LEN halfwords of the ring buffer go to the
+// other block. Volume, metering and requantization are applied in place
+// to the frames that start in that range, which end up to three halfwords
+// into the next block, before they are copied.
+void AudioBlockSwap(int target) {
+	
+	uint16_t	*dst = (uint16_t *)audio_block[!target];
+	int			rp = audio_status.readPtr, len = audio_status.bufLen, n;
+	int			phase = (audio_status.writePtr - rp) & 3;
+	
+	audio_status.dmaHalf = target;
+	
+	if((int)(audio_status.written - audio_status.consumed) < PIPE_LEN + phase) {
+		audio_status.underruns++;
+		memset(dst, 0, PIPE_LEN * 2);
+		return;
+	}
+	
+	if(METERING || gainActive()) {
+		n = rp + phase < len ? rp + phase : rp + phase - len;
+		readBlock(n, pipe, PIPE_FRAMES);
+		if(processBlock(pipe, PIPE_FRAMES))
+			writeBlock(n, pipe, PIPE_FRAMES);
+	}
+	
+	n = len - rp < PIPE_LEN ? len - rp : PIPE_LEN;
+	memcpy(dst, (uint16_t *)&audio_buffer[rp], n * 2);
+	memcpy(dst + n, (uint16_t *)audio_buffer, (PIPE_LEN - n) * 2);
+	
+	rp += PIPE_LEN;
+	audio_status.readPtr = rp >= len ? rp - len : rp;
+	audio_status.consumed += PIPE_LEN;
+}
+#endif
@@ -1,107 +1,119 @@
 #include "stm32f4xx.h"
 #include "debounce.h"
-
-#define MAXCOUNT2	5
+#include "profile.h"
+#include "utils.h"
 
 #define NBUTTONS	4
 
-volatile int8_t		buttonRising[NBUTTONS], buttonFalling[NBUTTONS], 
-					buttonSteady[NBUTTONS], button[NBUTTONS], old[NBUTTONS], 
-					count[NBUTTONS];
+// EXTI lines of the buttons, PB0, PB1, PB2 and PA4
+#define BUTTON_LINES	(EXTI_IMR_MR0 | EXTI_IMR_MR1 | EXTI_IMR_MR2 | EXTI_IMR_MR4)
 
-void debounceInit(void) {
+// Event ring, written only by the debounce interrupt and read only by the
+// USB interrupt. Power of two.
+#define NEVENTS		16
+
+static struct button_event	events[NEVENTS];
+static volatile uint32_t	evHead, evTail;
+
+// Debounced state and a two bit vertical counter per button, counting the
+// samples that differ from it
+static uint8_t		state, cnt0, cnt1;
+
+// Buttons held past BUTTON_LONG_MS and the time of their next long press
+// or repeat event
+static uint8_t		repeating;
+static uint32_t		nextHold[NBUTTONS];
+
+// Buttons down, bit n - 1 for button n
+static uint32_t buttonsRaw(void) {
+	
+	uint32_t	a = GPIOA->IDR, b = GPIOB->IDR;
+	
+	return (b & GPIO_IDR_ID1 ? 0 : 1) | (b & GPIO_IDR_ID2 ? 2 : 0) |
+	       (a & GPIO_IDR_ID4 ? 0 : 4) | (b & GPIO_IDR_ID0 ? 0 : 8);
+}
+
+// Mask the button lines so that contact bounce does not interrupt again,
+// and sample the buttons every millisecond until they are steady
+static void buttonEdge(void) {
+	
+	EXTI->IMR &= ~BUTTON_LINES;
+	EXTI->PR = BUTTON_LINES;
+	TIM5->CR1 |= TIM_CR1_CEN;
+}
 
-	int8_t	i;
+void debounceInit(void) {
 
 	// Clocks for GPIOA and GPIOB activated in main.c
 	
-	for(i = 0; i < NBUTTONS; ++i)
-		button[i] = buttonRising[i] = buttonFalling[i] = buttonSteady[i] = old[i] = count[i] = 0;
-		
-	//ticks2 = 0;
+	evHead = evTail = 0;
+	state = cnt0 = cnt1 = repeating = 0;
 	
-	// Set up a timer compare interrupt that triggers once every 1 ms
+	// Timer 5 update every 1 ms, started by a button edge
 	__disable_irq();
 	RCC->APB1ENR |= RCC_APB1ENR_TIM5EN;
 	TIM5->PSC = 4800 - 1;
 	TIM5->ARR = 10 - 1;
-	TIM5->CR1 |= TIM_CR1_CEN;
 	TIM5->DIER |= TIM_DIER_UIE;
-	NVIC_SetPriority(TIM5_IRQn, 15);
 	NVIC_EnableIRQ(TIM5_IRQn);
+	
+	// Interrupt on both edges of the button pins
+	RCC->APB2ENR |= RCC_APB2ENR_SYSCFGEN;
+	SYSCFG->EXTICR[0] = (SYSCFG->EXTICR[0] & ~(SYSCFG_EXTICR1_EXTI0 | SYSCFG_EXTICR1_EXTI1 | SYSCFG_EXTICR1_EXTI2)) |
+	                    SYSCFG_EXTICR1_EXTI0_PB | SYSCFG_EXTICR1_EXTI1_PB | SYSCFG_EXTICR1_EXTI2_PB;
+	SYSCFG->EXTICR[1] = (SYSCFG->EXTICR[1] & ~SYSCFG_EXTICR2_EXTI4) | SYSCFG_EXTICR2_EXTI4_PA;
+	EXTI->RTSR |= BUTTON_LINES;
+	EXTI->FTSR |= BUTTON_LINES;
+	EXTI->PR = BUTTON_LINES;
+	EXTI->IMR |= BUTTON_LINES;
+	NVIC_EnableIRQ(EXTI0_IRQn);
+	NVIC_EnableIRQ(EXTI1_IRQn);
+	NVIC_EnableIRQ(EXTI2_IRQn);
+	NVIC_EnableIRQ(EXTI4_IRQn);
+	
+	// A button held at reset
+	if(buttonsRaw() != state)
+		buttonEdge();
 	__enable_irq();
 	
 }
 
-int buttonPressed(void) {
+// Queue an event, dropped if the ring is full
+static void pushEvent(int button, int type, uint32_t time) {
 	
-	if(buttonRising[0]) {
-		buttonRising[0] = 0;
-		buttonFalling[0] = 0;
-		buttonSteady[0] = 0;
-		return 1;
-	}
-	else if(buttonRising[1]) {
-		buttonRising[1] = 0;
-		buttonFalling[1] = 0;
-		buttonSteady[1] = 0;
-		return 2;
-	}
-	else if(buttonRising[2]) {
-		buttonRising[2] = 0;
-		buttonFalling[2] = 0;
-		buttonSteady[2] = 0;
-		return 3;
-	}
-	else if(buttonRising[3]) {
-		buttonRising[3] = 0;
-		buttonFalling[3] = 0;
-		buttonSteady[3] = 0;
-		return 4;
-	}
-	else
-		return 0;
+	uint32_t	head = evHead;
+	
+	if(head - evTail == NEVENTS)
+		return;
+	
+	events[head % NEVENTS].time = time;
+	events[head % NEVENTS].button = button;
+	events[head % NEVENTS].type = type;
+	
+	// The event is written before it is published
+	__DMB();
+	evHead = head + 1;
 }
 
-int buttonReleased(void) {
+// Take the oldest event, returns 0 if there is none
+int buttonEvent(struct button_event *e) {
 	
-	if(buttonFalling[0]) {
-		buttonFalling[0] = 0;
-		buttonRising[0] = 0;
-		buttonSteady[0] = 0;
-		return 1;
-	}
-	else if(buttonFalling[1]) {
-		buttonFalling[1] = 0;
-		buttonRising[1] = 0;
-		buttonSteady[1] = 0;
-		return 2;
-	}
-	else if(buttonFalling[2]) {
-		buttonFalling[2] = 0;
-		buttonRising[2] = 0;
-		buttonSteady[2] = 0;
-		return 3;
-	}
-	else if(buttonFalling[3]) {
-		buttonFalling[3] = 0;
-		buttonRising[3] = 0;
-		buttonSteady[3] = 0;
-		return 4;
-	}
-	else
+	uint32_t	tail = evTail;
+	
+	if(tail == evHead)
 		return 0;
+	
+	__DMB();
+	*e = events[tail % NEVENTS];
+	__DMB();
+	evTail = tail + 1;
+	
+	return 1;
 }
 
-int buttonNPressed(int n) {
+int buttonEventPending(void) {
 	
-	if(n <= NBUTTONS && buttonFalling[n-1]) {
-		buttonFalling[n-1] = 0;
-		buttonRising[n-1] = 0;
-		buttonSteady[n-1] = 0;
-		return 1;
-	}
-	return 0;
+	return evTail != evHead;
 }
 
 int buttonNDown(int n) {
@@ -128,7 +140,7 @@ int buttonDown(void) {
 	
 	if((GPIOB->IDR & GPIO_IDR_ID1) == 0)
 		return 1;
-	else if((GPIOB->IDR & GPIO_IDR_ID2) == 1)
+	else if(GPIOB->IDR & GPIO_IDR_ID2)
 		return 2;
 	else if((GPIOA->IDR & GPIO_IDR_ID4) == 0)
 		return 3;
@@ -138,88 +150,70 @@ int buttonDown(void) {
 		return 0;
 }
 
-void TIM5_IRQHandler(void) {
+void EXTI0_IRQHandler(void) {
 	
-	// Check buttons
-	count[0] += 1;
-	if(!(GPIOB->IDR & GPIO_IDR_ID1)) {
-		if(!buttonRising[0] && !buttonSteady[0]) {
-			count[0] = 0;
-			buttonRising[0] = 1;
-			buttonFalling[0] = 0;
-		}
-		else if(count[0] >= MAXCOUNT2)
-			// Steady state reached
-			buttonSteady[0] = 1;
-	}
-	else if(buttonSteady[0]) {
-		if(!buttonFalling[0]) {
-			count[0] = 0;
-			buttonFalling[0] = 1;
-		}
-		else if(count[0] >= MAXCOUNT2)
-			buttonSteady[0] = 0;
-	}
+	buttonEdge();
+}
+
+void EXTI1_IRQHandler(void) {
 	
-	count[1] += 1;
-	if(GPIOB->IDR & GPIO_IDR_ID2) {
-		if(!buttonRising[1] && !buttonSteady[1]) {
-			count[1] = 0;
-			buttonRising[1] = 1;
-			buttonFalling[1] = 0;
-		}
-		else if(count[1] >= MAXCOUNT2)
-			// Steady state reached
-			buttonSteady[1] = 1;
-	}
-	else if(buttonSteady[1]) {
-		if(!buttonFalling[1]) {
-			count[1] = 0;
-			buttonFalling[1] = 1;
-		}
-		else if(count[1] >= MAXCOUNT2)
-			buttonSteady[1] = 0;
-	}
+	buttonEdge();
+}
 
-	count[2] += 1;
-	if(!(GPIOA->IDR & GPIO_IDR_ID4)) {
-		if(!buttonRising[2] && !buttonSteady[2]) {
-			count[2] = 0;
-			buttonRising[2] = 1;
-			buttonFalling[2] = 0;
-		}
-		else if(count[2] >= MAXCOUNT2)
-			// Steady state reached
-			buttonSteady[2] = 1;
-	}
-	else if(buttonSteady[2]) {
-		if(!buttonFalling[2]) {
-			count[2] = 0;
-			buttonFalling[2] = 1;
-		}
-		else if(count[2] >= MAXCOUNT2)
-			buttonSteady[2] = 0;
-	}
+void EXTI2_IRQHandler(void) {
+	
+	buttonEdge();
+}
+
+void EXTI4_IRQHandler(void) {
+	
+	buttonEdge();
+}
 
-	count[3] += 1;
-	if(!(GPIOB->IDR & GPIO_IDR_ID0)) {
-		if(!buttonRising[3] && !buttonSteady[3]) {
-			count[3] = 0;
-			buttonRising[3] = 1;
-			buttonFalling[3] = 0;
+// A button changes state after four samples in a row that differ from
+// it. The timer stops when all buttons are steady and released, it keeps
+// running while one is held for the long press and repeat events.
+void TIM5_IRQHandler(void) {
+	
+	uint32_t	delta, changed, now = getUptime();
+	int			i, bit;
+	PROFILE_ENTER();
+	
+	TIM5->SR = 0;
+	
+	delta = buttonsRaw() ^ state;
+	cnt1 = (cnt1 ^ cnt0) & delta;
+	cnt0 = ~cnt0 & delta;
+	changed = delta & ~(cnt0 | cnt1);
+	state ^= changed;
+	
+	for(i = 0; i < NBUTTONS; ++i) {
+		bit = 1 << i;
+		if(changed & bit) {
+			if(state & bit) {
+				pushEvent(i + 1, BUTTON_PRESS, now);
+				nextHold[i] = now + BUTTON_LONG_MS;
+				repeating &= ~bit;
+			}
+			else
+				pushEvent(i + 1, BUTTON_RELEASE, now);
 		}
-		else if(count[3] >= MAXCOUNT2)
-			// Steady state reached
-			buttonSteady[3] = 1;
-	}
-	else if(buttonSteady[3]) {
-		if(!buttonFalling[3]) {
-			count[3] = 0;
-			buttonFalling[3] = 1;
+		else if((state & bit) && ((int32_t)(now - nextHold[i]) >= 0)) {
+			pushEvent(i + 1, repeating & bit ? BUTTON_REPEAT : BUTTON_LONG, now);
+			nextHold[i] = now + BUTTON_REPEAT_MS;
+			repeating |= bit;
 		}
-		else if(count[3] >= MAXCOUNT2)
-			buttonSteady[3] = 0;
 	}
-
-	TIM5->SR = 0;
+	
+	if(!(delta & ~changed) && !state) {
+		TIM5->CR1 &= ~TIM_CR1_CEN;
+		EXTI->PR = BUTTON_LINES;
+		EXTI->IMR |= BUTTON_LINES;
+		
+		// An edge before the lines were unmasked
+		if(buttonsRaw() != state)
+			buttonEdge();
+	}
+	
+	PROFILE_EXIT(PROF_TIM5);
 }
\ No newline at end of file
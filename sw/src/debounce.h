@@ -3,9 +3,27 @@
 #define SCANFORWARD_BUTTON	3
 #define MUTE_BUTTON			4
 
+// Button events, queued by the debounce interrupt
+#define BUTTON_PRESS		0
+#define BUTTON_RELEASE		1
+#define BUTTON_LONG			2	// Held for BUTTON_LONG_MS
+#define BUTTON_REPEAT		3	// Every BUTTON_REPEAT_MS after BUTTON_LONG, while held
+
+#ifndef BUTTON_LONG_MS
+#define BUTTON_LONG_MS		800
+#endif
+#ifndef BUTTON_REPEAT_MS
+#define BUTTON_REPEAT_MS	200
+#endif
+
+struct button_event {
+	uint32_t	time;		// getUptime() at the event
+	uint8_t		button;		// One of the above
+	uint8_t		type;
+};
+
 void debounceInit(void);
-int buttonPressed(void);
-int buttonReleased(void);
-int buttonNPressed(int n);
+int buttonEvent(struct button_event *e);
+int buttonEventPending(void);
 int buttonDown(void);
 int buttonNDown(int n);
\ No newline at end of file
@@ -0,0 +1,72 @@
+// Rate feedback controller
+//
+// The fill level error of the ring buffer is turned into a correction of the
+// 10.14 feedback value sent to the host. A correction of c feedback units
+// changes the fill level by c / 4096 halfwords per ms, independent of the
+// sampling frequency. The gains below give a damping of about 0.7.
+// 44.1, 88.2 and 176.4 kHz use a lower bandwidth so that the controller
+// does not follow the 44/45 (88/89, 176/177) frame packet pattern.
+
+#include <stdint.h>
+#include "feedback.h"
+
+#define FIX(x)		((int32_t)((x) * 65536))
+
+struct pi_gains {
+	int			fs;
+	int32_t		kp, ki;
+};
+
+static const struct pi_gains	gains[] = {
+	{44100,		FIX(8),		FIX(1.0 / 128)},
+	{48000,		FIX(16),	FIX(1.0 / 32)},
+	{88200,		FIX(8),		FIX(1.0 / 128)},
+	{96000,		FIX(16),	FIX(1.0 / 32)},
+	{176400,	FIX(8),		FIX(1.0 / 128)},
+};
+
+void FeedbackInit(FeedbackPI *pi, int fs, int32_t limit) {
+	
+	unsigned int	i;
+	
+	pi->kp = gains[0].kp;
+	pi->ki = gains[0].ki;
+	for(i = 0; i < sizeof(gains) / sizeof(gains[0]); ++i)
+		if(gains[i].fs == fs) {
+			pi->kp = gains[i].kp;
+			pi->ki = gains[i].ki;
+		}
+	
+	pi->integ = 0;
+	pi->limit = limit;
+	pi->saturated = 0;
+}
+
+// Run one controller step. Called once per USB frame with the fill level
+// error in halfwords (target - fill). Returns the correction in feedback units.
+int FeedbackUpdate(FeedbackPI *pi, int error) {
+	
+	int64_t		p, i, u, lim = (int64_t)pi->limit << 16;
+	
+	p = (int64_t)pi->kp * error;
+	i = pi->integ + (int64_t)pi->ki * error;
+	if(i > lim)
+		i = lim;
+	else if(i < -lim)
+		i = -lim;
+	
+	u = p + i;
+	pi->saturated = 1;
+	if(u > lim)
+		u = lim;
+	else if(u < -lim)
+		u = -lim;
+	else
+		pi->saturated = 0;
+	
+	// Anti-windup: only integrate while the output is not clamped
+	if(!pi->saturated)
+		pi->integ = (int32_t)i;
+	
+	return (int)(u >> 16);
+}
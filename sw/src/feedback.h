@@ -0,0 +1,21 @@
+#ifndef FEEDBACK_H_
+#define	FEEDBACK_H_
+
+// Feedback is sent every 2^FB_RATE frames
+#define FB_RATE			2
+#define FB_LIMIT		1024	// Maximum deviation from the default feedback value
+#define FB_FILL_TOL		16		// Fill error in halfwords at which the feedback indicator LED lights
+
+// PI controller for the rate feedback. Gains and state are 16.16 fixed point
+typedef struct {
+	int32_t		kp;			// Proportional gain, feedback units per halfword of fill error
+	int32_t		ki;			// Integral gain, feedback units per halfword and ms
+	int32_t		integ;		// Integrator state
+	int32_t		limit;		// Output limit in feedback units
+	int			saturated;	// Output was clamped in the last update
+} FeedbackPI;
+
+void FeedbackInit(FeedbackPI *pi, int fs, int32_t limit);
+int FeedbackUpdate(FeedbackPI *pi, int error);
+
+#endif
@@ -0,0 +1,29 @@
+// Generated by tools/i2s_pll.py for HSE = 25000000 Hz. Do not edit.
+#ifndef I2S_PLL_H_
+#define	I2S_PLL_H_
+
+#define I2S_PLL_HSE	25000000
+
+#if defined(HSE_VALUE) && (HSE_VALUE != I2S_PLL_HSE)
+#error "i2s_pll.h was generated for another HSE frequency, run make i2s_pll"
+#endif
+
+struct i2s_pll {
+	int			fs;		// Nominal sampling frequency
+	uint8_t		m;		// PLLI2SM
+	uint16_t	n;		// PLLI2SN
+	uint8_t		r;		// PLLI2SR
+	uint8_t		div;	// I2SDIV
+	uint8_t		odd;	// I2SODD
+	uint32_t	fb;		// Actual sampling frequency in kHz, 10.14 feedback format
+};
+
+static const struct i2s_pll	i2s_pll_table[] = {
+	{44100,	20,	289,	2,	8,	0,	722500},	// 44097.900 Hz, -47.6 ppm
+	{48000,	21,	289,	2,	7,	0,	786395},	// 47997.715 Hz, -47.6 ppm
+	{88200,	20,	289,	2,	4,	0,	1445000},	// 88195.801 Hz, -47.6 ppm
+	{96000,	21,	289,	2,	3,	1,	1572789},	// 95995.429 Hz, -47.6 ppm
+	{176400,	20,	289,	2,	2,	0,	2890000},	// 176391.602 Hz, -47.6 ppm
+};
+
+#endif
@@ -0,0 +1,36 @@
+#include "stm32f4xx.h"
+#include "irq_prio.h"
+
+#define PRIO(irq, prio)		{irq, prio}
+
+static const struct {
+	IRQn_Type	irq;
+	uint8_t		preempt;
+	uint8_t		sub;
+} irqPrio[] = {
+	PRIO(DMA1_Stream4_IRQn,	IRQ_PRIO_I2S_DMA),
+	PRIO(PVD_IRQn,			IRQ_PRIO_PVD),
+	PRIO(OTG_FS_IRQn,		IRQ_PRIO_OTG),
+	PRIO(DMA2_Stream0_IRQn,	IRQ_PRIO_ADC_DMA),
+	PRIO(TIM4_IRQn,			IRQ_PRIO_TIM4),
+	PRIO(TIM5_IRQn,			IRQ_PRIO_TIM5),
+	PRIO(EXTI0_IRQn,		IRQ_PRIO_EXTI),
+	PRIO(EXTI1_IRQn,		IRQ_PRIO_EXTI),
+	PRIO(EXTI2_IRQn,		IRQ_PRIO_EXTI),
+	PRIO(EXTI4_IRQn,		IRQ_PRIO_EXTI),
+	PRIO(SysTick_IRQn,		IRQ_PRIO_SYSTICK),
+	PRIO(PendSV_IRQn,		IRQ_PRIO_PENDSV),
+};
+
+// Set the priority grouping and the priority of every interrupt in use.
+// Call before any of them is enabled, and after SysTick_Config, which
+// sets its own priority.
+void IRQPriorityInit(void) {
+	
+	unsigned int	i;
+	
+	NVIC_SetPriorityGrouping(IRQ_PRIO_GROUP);
+	
+	for(i = 0; i < sizeof(irqPrio) / sizeof(irqPrio[0]); ++i)
+		NVIC_SetPriority(irqPrio[i].irq, NVIC_EncodePriority(IRQ_PRIO_GROUP, irqPrio[i].preempt, irqPrio[i].sub));
+}
@@ -0,0 +1,28 @@
+#ifndef IRQ_PRIO_H_
+#define	IRQ_PRIO_H_
+
+// Interrupt priorities, all set by IRQPriorityInit. The modules only
+// enable their interrupts. Three bits of preemption priority and one bit
+// of sub-priority, lower is more urgent. The sub-priority only orders
+// pending interrupts with the same preemption priority.
+//
+// The audio path is at the top: the I2S DMA refill must not miss its
+// deadline and the USB interrupt must not be held off past a packet.
+// Metering, the LED ramp and the buttons may be delayed by any of them.
+
+#define IRQ_PRIO_GROUP		4	// PRIGROUP, preemption priority in bits 7:5
+
+//									Preempt		Sub
+#define IRQ_PRIO_I2S_DMA		0,			0	// DMA1 stream 4, I2S2 TX
+#define IRQ_PRIO_PVD			0,			1	// Power fail, output relay off
+#define IRQ_PRIO_OTG			1,			0	// USB
+#define IRQ_PRIO_ADC_DMA		4,			0	// DMA2 stream 0, level ADC
+#define IRQ_PRIO_TIM4			5,			0	// LED ramp
+#define IRQ_PRIO_TIM5			6,			0	// Button debounce
+#define IRQ_PRIO_EXTI			6,			0	// Button edges, start the debounce
+#define IRQ_PRIO_SYSTICK		6,			1	// Millisecond ticks
+#define IRQ_PRIO_PENDSV			7,			0	// Sampling frequency switch
+
+void IRQPriorityInit(void);
+
+#endif
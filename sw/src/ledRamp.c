@@ -1,6 +1,9 @@
 #include "stm32f4xx.h"
 #include "adc.h"
 #include "ledRamp.h"
+#include "profile.h"
+#include "arm_math.h"
+#include "meter.h"
 
 #define MAXVAL		4000
 #define NLEDS		10
@@ -15,12 +18,70 @@ volatile int	channel, peakVal[2], timeout[2];
 // LEDs: A2, A3, A7, A8, A10, B7, B8, B9, B10, C14
 // Row selector: C15
 
+// Pin of each LED on ports A, B and C
+static const uint16_t	ledPin[NLEDS][3] = {
+	{1 << 2, 0, 0}, {1 << 3, 0, 0}, {1 << 7, 0, 0}, {1 << 8, 0, 0}, {1 << 10, 0, 0},
+	{0, 1 << 7, 0}, {0, 1 << 8, 0}, {0, 1 << 9, 0}, {0, 1 << 10, 0},
+	{0, 0, 1 << 14},
+};
+
+// BSRR values for ports A, B and C that show ramp level -1 to NLEDS - 1
+static uint32_t			rampBSRR[NLEDS + 1][3];
+
+// LED ramp level for val, the number of thresholds below val minus one
+static int rampLevel(int val) {
+	
+	int		lo = 0, hi = NLEDS, mid;
+	
+	while(lo < hi) {
+		mid = (lo + hi + 1) / 2;
+		if(val > thresholds[mid - 1])
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+	
+	return lo - 1;
+}
+
+// Show the ramp up to level, the single LED peak if it is above, and
+// select the LED row. One store per port.
+static void showLEDs(int level, int peak, uint32_t row) {
+	
+	uint32_t	a = rampBSRR[level + 1][0], b = rampBSRR[level + 1][1], c = rampBSRR[level + 1][2];
+	
+	if((peak > level) && (peak < NLEDS)) {
+		a = (a & ~((uint32_t)ledPin[peak][0] << 16)) | ledPin[peak][0];
+		b = (b & ~((uint32_t)ledPin[peak][1] << 16)) | ledPin[peak][1];
+		c = (c & ~((uint32_t)ledPin[peak][2] << 16)) | ledPin[peak][2];
+	}
+	
+	GPIOA->BSRR = a;
+	GPIOB->BSRR = b;
+	GPIOC->BSRR = c | row;
+}
+
 void LEDRampInit(void) {
 	
+	int		level, i, p;
+	
 	channel = 0;
 	peakVal[0] = peakVal[1] = -1;
 	timeout[0] = timeout[1] = 0;
 	
+	// Set the LEDs up to the level and reset the rest
+	for(level = -1; level < NLEDS; ++level)
+		for(p = 0; p < 3; ++p) {
+			rampBSRR[level + 1][p] = 0;
+			for(i = 0; i < NLEDS; ++i)
+				rampBSRR[level + 1][p] |= i <= level ? ledPin[i][p] : (uint32_t)ledPin[i][p] << 16;
+		}
+	
+#ifdef DIGITAL_METER
+	// Each channel is read every other update
+	MeterInit(100);
+#endif
+	
 	// Set up timer 4 to update the LED ramp
 	RCC->APB1ENR |= RCC_APB1ENR_TIM4EN;
 	
@@ -40,20 +101,30 @@ void LEDRampInit(void) {
 }
 
 void TIM4_IRQHandler(void) {  
-
-	int	val, level;
+	
+	int	val, level, peak;
+	PROFILE_ENTER();
 		
 	channel = (channel + 1) % 2;
 		
+#ifdef DIGITAL_METER
+	// The bar shows the RMS level and a single LED the peak level, both
+	// falling at METER_DECAY_DB_S
+	MeterRead(channel, &val, &peak);
+	
+	level = rampLevel(val);
+	peak = rampLevel(peak);
+#else
 	val = ADCRead(channel);
 		
-	level = setLEDRampVal(val);
+	level = rampLevel(val);
+	peak = -1;
 		
 	timeout[channel] += 1;
 		
 	if(level < peakVal[channel]) {
 		if(timeout[channel] < TIMEOUT)
-			setLEDPeakVal(peakVal[channel]);
+			peak = peakVal[channel];
 		else {
 			timeout[channel] = 0;
 			peakVal[channel] = -1;
@@ -63,200 +134,34 @@ void TIM4_IRQHandler(void) {
 		peakVal[channel] = level;
 		timeout[channel] = 0;
 	}
+#endif
 		
-	if(channel)
-		GPIOC->BSRR |= GPIO_BSRR_BR15;
-	else
-		GPIOC->BSRR |= GPIO_BSRR_BS15;
-
+	showLEDs(level, peak, channel ? GPIO_BSRR_BR15 : GPIO_BSRR_BS15);
+	
 	if(TIM4->SR & TIM_SR_UIF)
 		TIM4->SR &= ~TIM_SR_UIF;
-
+	
+	PROFILE_EXIT(PROF_TIM4);
 }
 	
+// Show val on the ramp, returns the level
 int setLEDRampVal(int val) {
 	
-	int		level;
+	int		level = rampLevel(val);
 	
-	if(val > thresholds[9]) {
-		GPIOA->BSRR |= GPIO_BSRR_BS2;
-		GPIOA->BSRR |= GPIO_BSRR_BS3;
-		GPIOA->BSRR |= GPIO_BSRR_BS7;
-		GPIOA->BSRR |= GPIO_BSRR_BS8;
-		GPIOA->BSRR |= GPIO_BSRR_BS10;
-		GPIOB->BSRR |= GPIO_BSRR_BS7;
-		GPIOB->BSRR |= GPIO_BSRR_BS8;
-		GPIOB->BSRR |= GPIO_BSRR_BS9;
-		GPIOB->BSRR |= GPIO_BSRR_BS10;
-		GPIOC->BSRR |= GPIO_BSRR_BS14;
-		level = 9;
-	}
-	else if(val > thresholds[8]) {
-		GPIOA->BSRR |= GPIO_BSRR_BS2;
-		GPIOA->BSRR |= GPIO_BSRR_BS3;
-		GPIOA->BSRR |= GPIO_BSRR_BS7;
-		GPIOA->BSRR |= GPIO_BSRR_BS8;
-		GPIOA->BSRR |= GPIO_BSRR_BS10;
-		GPIOB->BSRR |= GPIO_BSRR_BS7;
-		GPIOB->BSRR |= GPIO_BSRR_BS8;
-		GPIOB->BSRR |= GPIO_BSRR_BS9;
-		GPIOB->BSRR |= GPIO_BSRR_BS10;
-		GPIOC->BSRR |= GPIO_BSRR_BR14;
-		level = 8;
-	}
-	else if(val > thresholds[7]) {
-		GPIOA->BSRR |= GPIO_BSRR_BS2;
-		GPIOA->BSRR |= GPIO_BSRR_BS3;
-		GPIOA->BSRR |= GPIO_BSRR_BS7;
-		GPIOA->BSRR |= GPIO_BSRR_BS8;
-		GPIOA->BSRR |= GPIO_BSRR_BS10;
-		GPIOB->BSRR |= GPIO_BSRR_BS7;
-		GPIOB->BSRR |= GPIO_BSRR_BS8;
-		GPIOB->BSRR |= GPIO_BSRR_BS9;
-		GPIOB->BSRR |= GPIO_BSRR_BR10;
-		GPIOC->BSRR |= GPIO_BSRR_BR14;
-		level = 7;
-	}
-	else if(val > thresholds[6]) {
-		GPIOA->BSRR |= GPIO_BSRR_BS2;
-		GPIOA->BSRR |= GPIO_BSRR_BS3;
-		GPIOA->BSRR |= GPIO_BSRR_BS7;
-		GPIOA->BSRR |= GPIO_BSRR_BS8;
-		GPIOA->BSRR |= GPIO_BSRR_BS10;
-		GPIOB->BSRR |= GPIO_BSRR_BS7;
-		GPIOB->BSRR |= GPIO_BSRR_BS8;
-		GPIOB->BSRR |= GPIO_BSRR_BR9;
-		GPIOB->BSRR |= GPIO_BSRR_BR10;
-		GPIOC->BSRR |= GPIO_BSRR_BR14;
-		level = 6;
-	}
-	else if(val > thresholds[5]) {
-		GPIOA->BSRR |= GPIO_BSRR_BS2;
-		GPIOA->BSRR |= GPIO_BSRR_BS3;
-		GPIOA->BSRR |= GPIO_BSRR_BS7;
-		GPIOA->BSRR |= GPIO_BSRR_BS8;
-		GPIOA->BSRR |= GPIO_BSRR_BS10;
-		GPIOB->BSRR |= GPIO_BSRR_BS7;
-		GPIOB->BSRR |= GPIO_BSRR_BR8;
-		GPIOB->BSRR |= GPIO_BSRR_BR9;
-		GPIOB->BSRR |= GPIO_BSRR_BR10;
-		GPIOC->BSRR |= GPIO_BSRR_BR14;
-		level = 5;
-	}
-	else if(val > thresholds[4]) {
-		GPIOA->BSRR |= GPIO_BSRR_BS2;
-		GPIOA->BSRR |= GPIO_BSRR_BS3;
-		GPIOA->BSRR |= GPIO_BSRR_BS7;
-		GPIOA->BSRR |= GPIO_BSRR_BS8;
-		GPIOA->BSRR |= GPIO_BSRR_BS10;
-		GPIOB->BSRR |= GPIO_BSRR_BR7;
-		GPIOB->BSRR |= GPIO_BSRR_BR8;
-		GPIOB->BSRR |= GPIO_BSRR_BR9;
-		GPIOB->BSRR |= GPIO_BSRR_BR10;
-		GPIOC->BSRR |= GPIO_BSRR_BR14;
-		level = 4;
-	}
-	else if(val > thresholds[3]) {
-		GPIOA->BSRR |= GPIO_BSRR_BS2;
-		GPIOA->BSRR |= GPIO_BSRR_BS3;
-		GPIOA->BSRR |= GPIO_BSRR_BS7;
-		GPIOA->BSRR |= GPIO_BSRR_BS8;
-		GPIOA->BSRR |= GPIO_BSRR_BR10;
-		GPIOB->BSRR |= GPIO_BSRR_BR7;
-		GPIOB->BSRR |= GPIO_BSRR_BR8;
-		GPIOB->BSRR |= GPIO_BSRR_BR9;
-		GPIOB->BSRR |= GPIO_BSRR_BR10;
-		GPIOC->BSRR |= GPIO_BSRR_BR14;
-		level = 3;
-	}
-	else if(val > thresholds[2]) {
-		GPIOA->BSRR |= GPIO_BSRR_BS2;
-		GPIOA->BSRR |= GPIO_BSRR_BS3;
-		GPIOA->BSRR |= GPIO_BSRR_BS7;
-		GPIOA->BSRR |= GPIO_BSRR_BR8;
-		GPIOA->BSRR |= GPIO_BSRR_BR10;
-		GPIOB->BSRR |= GPIO_BSRR_BR7;
-		GPIOB->BSRR |= GPIO_BSRR_BR8;
-		GPIOB->BSRR |= GPIO_BSRR_BR9;
-		GPIOB->BSRR |= GPIO_BSRR_BR10;
-		GPIOC->BSRR |= GPIO_BSRR_BR14;
-		level = 2;
-	}
-	else if(val > thresholds[1]) {
-		GPIOA->BSRR |= GPIO_BSRR_BS2;
-		GPIOA->BSRR |= GPIO_BSRR_BS3;
-		GPIOA->BSRR |= GPIO_BSRR_BR7;
-		GPIOA->BSRR |= GPIO_BSRR_BR8;
-		GPIOA->BSRR |= GPIO_BSRR_BR10;
-		GPIOB->BSRR |= GPIO_BSRR_BR7;
-		GPIOB->BSRR |= GPIO_BSRR_BR8;
-		GPIOB->BSRR |= GPIO_BSRR_BR9;
-		GPIOB->BSRR |= GPIO_BSRR_BR10;
-		GPIOC->BSRR |= GPIO_BSRR_BR14;
-		level = 1;
-	}
-	else if(val > thresholds[0]) {
-		GPIOA->BSRR |= GPIO_BSRR_BS2;
-		GPIOA->BSRR |= GPIO_BSRR_BR3;
-		GPIOA->BSRR |= GPIO_BSRR_BR7;
-		GPIOA->BSRR |= GPIO_BSRR_BR8;
-		GPIOA->BSRR |= GPIO_BSRR_BR10;
-		GPIOB->BSRR |= GPIO_BSRR_BR7;
-		GPIOB->BSRR |= GPIO_BSRR_BR8;
-		GPIOB->BSRR |= GPIO_BSRR_BR9;
-		GPIOB->BSRR |= GPIO_BSRR_BR10;
-		GPIOC->BSRR |= GPIO_BSRR_BR14;
-		level = 0;
-	}
-	else {
-		GPIOA->BSRR |= GPIO_BSRR_BR2;
-		GPIOA->BSRR |= GPIO_BSRR_BR3;
-		GPIOA->BSRR |= GPIO_BSRR_BR7;
-		GPIOA->BSRR |= GPIO_BSRR_BR8;
-		GPIOA->BSRR |= GPIO_BSRR_BR10;
-		GPIOB->BSRR |= GPIO_BSRR_BR7;
-		GPIOB->BSRR |= GPIO_BSRR_BR8;
-		GPIOB->BSRR |= GPIO_BSRR_BR9;
-		GPIOB->BSRR |= GPIO_BSRR_BR10;
-		GPIOC->BSRR |= GPIO_BSRR_BR14;
-		level = -1;
-	}
+	GPIOA->BSRR = rampBSRR[level + 1][0];
+	GPIOB->BSRR = rampBSRR[level + 1][1];
+	GPIOC->BSRR = rampBSRR[level + 1][2];
 	
 	return level;
 }
 
+// Light the LED for level val in addition to the ramp
 void setLEDPeakVal(int val) {
 	
-	switch(val) {
-		case 0:
-			GPIOA->BSRR |= GPIO_BSRR_BS2;
-			break;
-		case 1:
-			GPIOA->BSRR |= GPIO_BSRR_BS3;
-			break;
-		case 2:
-			GPIOA->BSRR |= GPIO_BSRR_BS7;
-			break;
-		case 3:
-			GPIOA->BSRR |= GPIO_BSRR_BS8;
-			break;
-		case 4:
-			GPIOA->BSRR |= GPIO_BSRR_BS10;
-			break;
-		case 5:
-			GPIOB->BSRR |= GPIO_BSRR_BS7;
-			break;
-		case 6:
-			GPIOB->BSRR |= GPIO_BSRR_BS8;
-			break;
-		case 7:
-			GPIOB->BSRR |= GPIO_BSRR_BS9;
-			break;
-		case 8:
-			GPIOB->BSRR |= GPIO_BSRR_BS10;
-			break;
-		case 9:
-			GPIOC->BSRR |= GPIO_BSRR_BS14;
-			break;
+	if((val >= 0) && (val < NLEDS)) {
+		GPIOA->BSRR = ledPin[val][0];
+		GPIOB->BSRR = ledPin[val][1];
+		GPIOC->BSRR = ledPin[val][2];
 	}
 }
\ No newline at end of file
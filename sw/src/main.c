@@ -9,6 +9,8 @@
 #endif
 #include "debounce.h"
 #include "usb_streamer.h"
+#include "profile.h"
+#include "irq_prio.h"
 
 void ClockInit(void) {
 
@@ -83,27 +85,7 @@ void ClockInit(void) {
 	RCC->CFGR = (RCC->CFGR & ~(RCC_CFGR_SW)) | RCC_CFGR_SW_PLL;
 	while((RCC->CFGR & RCC_CFGR_SWS) != RCC_CFGR_SWS_PLL);
 	
-	// Set I2S PLL dividers to:
-	// M = 25, N = 344, R = 2
-	// This gives an I2S clock of  25 MHz / 25 * 344 / 2 = 172 MHz
-	// and a sampling frequency of fs = 95.982 kHz when I2SDIV = 3 and I2SODD = 1
-	// In this case, MCLK = I2S clock / (2 * I2SDIV + I2SODD)
-	// MCLK is 256xfs
-	//
-	tmpReg = RCC->PLLI2SCFGR;
-	tmpReg &= ~RCC_PLLI2SCFGR_PLLI2SR;
-	tmpReg |= 2 << RCC_PLLI2SCFGR_PLLI2SR_Pos;
-	
-	tmpReg &= ~RCC_PLLI2SCFGR_PLLI2SN;
-	tmpReg |= 344 << RCC_PLLI2SCFGR_PLLI2SN_Pos;
-	
-	tmpReg &= ~RCC_PLLI2SCFGR_PLLI2SM;
-	tmpReg |= 25 << RCC_PLLI2SCFGR_PLLI2SM_Pos;
-	RCC->PLLI2SCFGR = tmpReg;
-	
-	// Enable the I2S PLL
-	RCC->CR |= RCC_CR_PLLI2SON;
-	while(!(RCC->CR & RCC_CR_PLLI2SRDY));
+	// The I2S PLL is configured by AudioInit
 	
 	// Clear All Interrupts
 	RCC->CIR = 0x00df0000;
@@ -267,6 +249,8 @@ int main (void) {
 	ClockInit();
 	SystemCoreClockUpdate();
 	(void) SysTick_Config(SystemCoreClock / 1000);
+	IRQPriorityInit();
+	ProfileInit();
 	GPIOInit();
 	ShutdownCtlInit();
 	
@@ -353,7 +337,9 @@ int main (void) {
 	delay_ms(50);
 	GPIOA->BSRR |= GPIO_BSRR_BR2;
 	
+#ifndef DIGITAL_METER
 	ADCInit();
+#endif
 	LEDRampInit();
 	
 	delay_ms(1000);
@@ -363,6 +349,7 @@ int main (void) {
 	
     while (1) {
         //__WFI(); // Wait for interrupt
+        ProfileBus();
     }
 
     // Return 0 to satisfy compiler
@@ -0,0 +1,93 @@
+#include <stdint.h>
+#include <math.h>
+#include "arm_math.h"
+#include "stm32f4xx.h"
+#include "audio.h"
+#include "meter.h"
+
+#ifdef DIGITAL_METER
+
+// Collected by MeterBlock between two reads of a channel
+static volatile q31_t		blockPeak[2];
+static volatile uint64_t	energy[2];		// Sum of squares, Q31
+static volatile uint32_t	frames[2];
+
+// Displayed levels after ballistics
+static q31_t	rmsLevel[2], peakLevel[2], decay;
+static q31_t	chan[MAX_PACKET_FRAMES];
+
+// readHz is the rate at which MeterRead is called for each channel
+void MeterInit(int readHz) {
+	
+	decay = (q31_t)(powf(10.0f, -METER_DECAY_DB_S / (20.0f * readHz)) * 2147483648.0f);
+	rmsLevel[0] = rmsLevel[1] = 0;
+	peakLevel[0] = peakLevel[1] = 0;
+}
+
+// Add a block of nFrames interleaved stereo frames. Called from the audio
+// ingest with blocks of at most MAX_PACKET_FRAMES.
+void MeterBlock(const q31_t *buf, int nFrames) {
+	
+	q63_t		power;
+	q31_t		peak;
+	uint32_t	idx;
+	int			ch, i;
+	
+	if(nFrames <= 0)
+		return;
+	
+	for(ch = 0; ch < 2; ++ch) {
+		for(i = 0; i < nFrames; ++i)
+			chan[i] = buf[2 * i + ch];
+		
+		// Sum of squares in 16.48, arm_rms_q31 has a single guard bit and
+		// wraps on loud blocks
+		arm_power_q31(chan, nFrames, &power);
+		arm_abs_q31(chan, chan, nFrames);
+		arm_max_q31(chan, nFrames, &peak, &idx);
+		
+		// MeterRead may preempt
+		__disable_irq();
+		if(peak > blockPeak[ch])
+			blockPeak[ch] = peak;
+		energy[ch] += (uint64_t)(power >> 17);
+		frames[ch] += nFrames;
+		__enable_irq();
+	}
+}
+
+static q31_t ballistics(q31_t level, q31_t in) {
+	
+	level = (q31_t)(((q63_t)level * decay) >> 31);
+	
+	return in > level ? in : level;
+}
+
+// RMS and peak level of channel ch since its last read, scaled so that
+// full scale is METER_FULL_SCALE
+void MeterRead(int ch, int *rms, int *peak) {
+	
+	uint64_t	e;
+	uint32_t	n;
+	q31_t		p, r = 0;
+	
+	__disable_irq();
+	e = energy[ch];
+	n = frames[ch];
+	p = blockPeak[ch];
+	energy[ch] = 0;
+	frames[ch] = 0;
+	blockPeak[ch] = 0;
+	__enable_irq();
+	
+	if(n)
+		arm_sqrt_q31((q31_t)(e / n), &r);
+	
+	rmsLevel[ch] = ballistics(rmsLevel[ch], r);
+	peakLevel[ch] = ballistics(peakLevel[ch], p);
+	
+	*rms = (int)(((q63_t)rmsLevel[ch] * METER_FULL_SCALE) >> 31);
+	*peak = (int)(((q63_t)peakLevel[ch] * METER_FULL_SCALE) >> 31);
+}
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef METER_H_
+#define	METER_H_
+
+// Digital level metering of the sample stream for the LED ramp. Build with
+// -D DIGITAL_METER to use it instead of the analog taps on PA0/PA1, which
+// also turns off the ADC and its DMA.
+
+// Level that corresponds to full scale, in the units of the LED ramp
+// thresholds
+#ifndef METER_FULL_SCALE
+#define METER_FULL_SCALE	4000
+#endif
+
+// Fall rate of the displayed RMS and peak levels. Rises are immediate.
+#ifndef METER_DECAY_DB_S
+#define METER_DECAY_DB_S	20
+#endif
+
+void MeterInit(int readHz);
+void MeterBlock(const q31_t *buf, int nFrames);
+void MeterRead(int ch, int *rms, int *peak);
+
+#endif
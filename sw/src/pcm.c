@@ -0,0 +1,271 @@
+// Sample format conversion from USB packet layout to I2S halfword layout
+//
+// The I2S interface is a 16-bit register that is loaded twice per 24-bit
+// sample, MSB first. One stereo frame therefore occupies four halfwords in
+// the audio buffer: L[23:8], L[7:0] << 8, R[23:8], R[7:0] << 8.
+
+#include <stdint.h>
+#include "arm_math.h"
+#include "pcm.h"
+
+// Unpack nFrames packed 24-bit stereo frames from src into dst.
+// src is a word stream such as the USB RX FIFO: every read yields the
+// next word, so the pointer is never advanced.
+// Three 32-bit words hold two stereo frames:
+//   w0 = R0[7:0]  L0[23:0]
+//   w1 = L1[15:0] R0[23:8]
+//   w2 = R1[23:0] L1[23:16]
+// If nFrames is odd, the last frame is read from two words.
+// Halfword pairs that fall on a word boundary in dst are stored as one word.
+// At odd halfword alignment those stores are unaligned, which the M4 allows
+// for single word stores, but not for the STRD/STM the compiler may merge
+// adjacent stores into. __UNALIGNED_UINT32_WRITE keeps them single stores.
+void PCMUnpack24(uint16_t *dst, volatile uint32_t *src, int nFrames) {
+	
+	uint32_t	w0, w1, w2;
+	
+	if(((uintptr_t)dst & 2) == 0) {
+		// Word aligned. Each frame is two word stores: (hi, lo) for L and R
+		for(; nFrames >= 2; nFrames -= 2) {
+			w0 = PCM_READ(src);
+			w1 = PCM_READ(src);
+			w2 = PCM_READ(src);
+			
+			((uint32_t *)dst)[0] = ((w0 >> 8) & 0xffff) | (w0 << 24);
+			((uint32_t *)dst)[1] = __PKHBT(w1, w0 & 0xff000000, 0);
+			((uint32_t *)dst)[2] = (w1 >> 24) | ((w2 & 0xff) << 8) | ((w1 << 8) & 0xff000000);
+			((uint32_t *)dst)[3] = (w2 >> 16) | ((w2 << 16) & 0xff000000);
+			dst += 8;
+		}
+	}
+	else {
+		// Odd halfword alignment. The first and last halfword of each pair of
+		// frames are stored alone, the three pairs in between as words
+		for(; nFrames >= 2; nFrames -= 2) {
+			w0 = PCM_READ(src);
+			w1 = PCM_READ(src);
+			w2 = PCM_READ(src);
+			
+			dst[0] = (w0 >> 8) & 0xffff;
+			__UNALIGNED_UINT32_WRITE(&dst[1], __PKHBT(w0 << 8, w1, 16));
+			__UNALIGNED_UINT32_WRITE(&dst[3], ((w0 >> 16) & 0xff00) | ((w1 >> 8) & 0xff0000) | (w2 << 24));
+			__UNALIGNED_UINT32_WRITE(&dst[5], __PKHTB(w2, (w1 >> 8) & 0xff00, 0));
+			dst[7] = w2 & 0xff00;
+			dst += 8;
+		}
+	}
+	
+	if(nFrames) {
+		w0 = PCM_READ(src);
+		w1 = PCM_READ(src);
+		
+		dst[0] = (w0 >> 8) & 0xffff;
+		dst[1] = (w0 << 8) & 0xff00;
+		dst[2] = w1 & 0xffff;
+		dst[3] = (w0 >> 16) & 0xff00;
+	}
+}
+
+// Decode nFrames packed 24-bit stereo frames from the word stream src into
+// interleaved Q31 samples, same word layout as PCMUnpack24. The low byte of
+// each sample is zero.
+void PCMDecode24(q31_t *dst, volatile uint32_t *src, int nFrames) {
+	
+	uint32_t	w0, w1, w2;
+	
+	for(; nFrames >= 2; nFrames -= 2) {
+		w0 = PCM_READ(src);
+		w1 = PCM_READ(src);
+		w2 = PCM_READ(src);
+		
+		dst[0] = w0 << 8;
+		dst[1] = (w1 << 16) | ((w0 >> 16) & 0xff00);
+		dst[2] = (w2 << 24) | ((w1 >> 8) & 0xffff00);
+		dst[3] = w2 & 0xffffff00;
+		dst += 4;
+	}
+	
+	if(nFrames) {
+		w0 = PCM_READ(src);
+		w1 = PCM_READ(src);
+		
+		dst[0] = w0 << 8;
+		dst[1] = (w1 << 16) | ((w0 >> 16) & 0xff00);
+	}
+}
+
+// Pack nFrames interleaved Q31 stereo frames into the I2S halfword layout.
+// Bits 7:0 of each sample are truncated.
+void PCMPack24(uint16_t *dst, const q31_t *src, int nFrames) {
+	
+	for(; nFrames > 0; --nFrames) {
+		dst[0] = src[0] >> 16;
+		dst[1] = src[0] & 0xff00;
+		dst[2] = src[1] >> 16;
+		dst[3] = src[1] & 0xff00;
+		src += 2;
+		dst += 4;
+	}
+}
+
+// Decode nFrames frames in the I2S halfword layout into interleaved Q31
+// samples, the inverse of PCMPack24
+void PCMDecodeI2S(q31_t *dst, const uint16_t *src, int nFrames) {
+	
+	for(; nFrames > 0; --nFrames) {
+		dst[0] = ((uint32_t)src[0] << 16) | src[1];
+		dst[1] = ((uint32_t)src[2] << 16) | src[3];
+		src += 4;
+		dst += 2;
+	}
+}
+
+static int		ditherMode = PCM_DITHER;
+static uint32_t	rng = 2463534242u;	// xorshift32 state, never zero
+static int32_t	err1[2], err2[2];	// Previous two quantization errors per channel
+
+int PCMSetDither(int mode) {
+	
+	if((mode < DITHER_OFF) || (mode > DITHER_SHAPE2))
+		return 0;
+	
+	err1[0] = err1[1] = err2[0] = err2[1] = 0;
+	ditherMode = mode;
+	
+	return 1;
+}
+
+int PCMGetDither(void) {
+	
+	return ditherMode;
+}
+
+// Round nFrames interleaved Q31 stereo frames to 24 bits in place, so that
+// PCMPack24 drops only zero bits. The dither is the sum of two 8-bit
+// uniform values from one xorshift32 output, triangular over +-1 LSB.
+// The noise shapers feed back the quantization error with the error
+// transfer function (1 - z^-1) or (1 - z^-1)^2.
+void PCMRequantize24(q31_t *buf, int nFrames) {
+	
+	int			mode = ditherMode, i;
+	uint32_t	r = rng;
+	int32_t		d, e;
+	int64_t		v, y;
+	
+	if(mode == DITHER_OFF)
+		return;
+	
+	for(i = 0; i < 2 * nFrames; ++i) {
+		r ^= r << 13;
+		r ^= r >> 17;
+		r ^= r << 5;
+		d = (int32_t)(r & 0xff) + (int32_t)((r >> 8) & 0xff) - 255;
+		
+		v = buf[i];
+		if(mode == DITHER_SHAPE1)
+			v -= err1[i & 1];
+		else if(mode == DITHER_SHAPE2)
+			v -= 2 * err1[i & 1] - err2[i & 1];
+		
+		y = (v + d + 128) & ~0xff;
+		if(y > 0x7fffff00)
+			y = 0x7fffff00;
+		else if(y < -0x7fffffff - 1)
+			y = -0x7fffffff - 1;
+		buf[i] = (q31_t)y;
+		
+		// Limit the error so that clipping cannot make the shaper unstable
+		e = (int32_t)(y - v);
+		e = e > 1024 ? 1024 : (e < -1024 ? -1024 : e);
+		err2[i & 1] = err1[i & 1];
+		err1[i & 1] = e;
+	}
+	rng = r;
+}
+
+// Unpack nFrames packed 16-bit stereo frames from the word stream src into
+// dst. Each word is one frame, L in the low and R in the high halfword, and
+// becomes L, 0, R, 0 in the I2S layout. At odd halfword alignment the
+// middle halfwords of consecutive frames pair up into unaligned word
+// stores, see PCMUnpack24.
+void PCMUnpack16(uint16_t *dst, volatile uint32_t *src, int nFrames) {
+	
+	uint32_t	w, next;
+	
+	if(((uintptr_t)dst & 2) == 0) {
+		for(; nFrames > 0; --nFrames) {
+			w = PCM_READ(src);
+			((uint32_t *)dst)[0] = w & 0xffff;
+			((uint32_t *)dst)[1] = w >> 16;
+			dst += 4;
+		}
+	}
+	else if(nFrames > 0) {
+		w = PCM_READ(src);
+		dst[0] = w & 0xffff;
+		for(; nFrames > 1; --nFrames) {
+			next = PCM_READ(src);
+			__UNALIGNED_UINT32_WRITE(&dst[1], w & 0xffff0000);
+			__UNALIGNED_UINT32_WRITE(&dst[3], next << 16);
+			w = next;
+			dst += 4;
+		}
+		__UNALIGNED_UINT32_WRITE(&dst[1], w & 0xffff0000);
+		dst[3] = 0;
+	}
+}
+
+// Decode nFrames packed 16-bit stereo frames into interleaved Q31 samples
+void PCMDecode16(q31_t *dst, volatile uint32_t *src, int nFrames) {
+	
+	uint32_t	w;
+	
+	for(; nFrames > 0; --nFrames) {
+		w = PCM_READ(src);
+		dst[0] = w << 16;
+		dst[1] = w & 0xffff0000;
+		dst += 2;
+	}
+}
+
+// Unpack nFrames stereo frames of 24-bit samples in 32-bit containers from
+// the word stream src into dst. Each sample is one word, sample bits in
+// [31:8], and its two I2S halfwords are the word rotated by 16. At odd
+// halfword alignment the low halfword of one sample pairs up with the high
+// halfword of the next in an unaligned word store, see PCMUnpack24.
+void PCMUnpack32(uint16_t *dst, volatile uint32_t *src, int nFrames) {
+	
+	uint32_t	l, r;
+	
+	if(((uintptr_t)dst & 2) == 0) {
+		for(; nFrames > 0; --nFrames) {
+			l = PCM_READ(src);
+			r = PCM_READ(src);
+			((uint32_t *)dst)[0] = __ROR(l, 16) & 0xff00ffff;
+			((uint32_t *)dst)[1] = __ROR(r, 16) & 0xff00ffff;
+			dst += 4;
+		}
+	}
+	else if(nFrames > 0) {
+		l = PCM_READ(src);
+		dst[0] = l >> 16;
+		for(;;) {
+			r = PCM_READ(src);
+			__UNALIGNED_UINT32_WRITE(&dst[1], __PKHBT(l & 0xff00, r, 0));
+			if(--nFrames == 0)
+				break;
+			l = PCM_READ(src);
+			__UNALIGNED_UINT32_WRITE(&dst[3], __PKHBT(r & 0xff00, l, 0));
+			dst += 4;
+		}
+		dst[3] = r & 0xff00;
+	}
+}
+
+// Decode nFrames stereo frames in 32-bit containers into interleaved Q31
+// samples. The container is already Q31, only the padding byte is cleared.
+void PCMDecode32(q31_t *dst, volatile uint32_t *src, int nFrames) {
+	
+	for(nFrames *= 2; nFrames > 0; --nFrames)
+		*dst++ = PCM_READ(src) & 0xffffff00;
+}
@@ -0,0 +1,35 @@
+#ifndef PCM_H_
+#define	PCM_H_
+
+// Read the next word of a packet from the USB RX FIFO. The host build
+// reads from a simulated FIFO.
+#ifdef AUDIO_HOST
+#include "../host/usb_fifo.h"
+#else
+#define PCM_READ(src)	(*(src))
+#endif
+
+// Requantization of the Q31 path to 24 bits
+#define DITHER_OFF		0	// Truncate
+#define DITHER_TPDF		1	// TPDF dither, +-1 LSB
+#define DITHER_SHAPE1	2	// TPDF dither with first order noise shaping
+#define DITHER_SHAPE2	3	// TPDF dither with second order noise shaping
+
+// Requantization mode at startup, can be changed with PCMSetDither
+#ifndef PCM_DITHER
+#define PCM_DITHER		DITHER_TPDF
+#endif
+
+void PCMUnpack24(uint16_t *dst, volatile uint32_t *src, int nFrames);
+void PCMDecode24(q31_t *dst, volatile uint32_t *src, int nFrames);
+void PCMUnpack16(uint16_t *dst, volatile uint32_t *src, int nFrames);
+void PCMDecode16(q31_t *dst, volatile uint32_t *src, int nFrames);
+void PCMUnpack32(uint16_t *dst, volatile uint32_t *src, int nFrames);
+void PCMDecode32(q31_t *dst, volatile uint32_t *src, int nFrames);
+void PCMPack24(uint16_t *dst, const q31_t *src, int nFrames);
+void PCMDecodeI2S(q31_t *dst, const uint16_t *src, int nFrames);
+void PCMRequantize24(q31_t *buf, int nFrames);
+int PCMSetDither(int mode);
+int PCMGetDither(void);
+
+#endif
@@ -0,0 +1,245 @@
+#include <stdint.h>
+#include <string.h>
+#include "stm32f4xx.h"
+#include "profile.h"
+#include "utils.h"
+
+#ifdef ISR_PROFILE
+
+static struct profile_stat		stats[PROF_COUNT];
+static struct profile_latency	latency;
+static volatile int				nesting, maxNesting;
+static uint32_t					lastSOF, periodQ8;	// Mean SOF interval in 1/256 cycles
+static int						sofCount;
+static volatile uint32_t		entries;	// Handler entries, to spot a preempted copy
+static struct profile_bus		bus;
+static uint32_t					copySrc[PROFILE_COPY / 4], copyDst[PROFILE_COPY / 4];
+static uint32_t					lastCopy;
+
+// Copy returned over USB, so that the control transfer does not read a
+// record while a handler updates it
+static union {
+	struct profile_stat		stat;
+	struct profile_summary	summary;
+	struct profile_bus		bus;
+	struct profile_latency	latency;
+} snapshot;
+
+void ProfileInit(void) {
+	
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CYCCNT = 0;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+	
+	ProfileReset();
+}
+
+void ProfileReset(void) {
+	
+	int		i;
+	
+	__disable_irq();
+	memset(stats, 0, sizeof(stats));
+	for(i = 0; i < PROF_COUNT; ++i)
+		stats[i].min = 0xffffffff;
+	memset(&bus, 0, sizeof(bus));
+	bus.stat.min = 0xffffffff;
+	memset(&latency, 0, sizeof(latency));
+	maxNesting = 0;
+	sofCount = 0;
+	__enable_irq();
+}
+
+uint32_t ProfileEnter(void) {
+	
+	entries++;
+	if(++nesting > maxNesting)
+		maxNesting = nesting;
+	
+	return DWT->CYCCNT;
+}
+
+uint32_t ProfileCycles(void) {
+	
+	return DWT->CYCCNT;
+}
+
+static void statAdd(struct profile_stat *s, uint32_t cycles) {
+	
+	int		bin;
+	
+	s->count++;
+	s->sum += cycles;
+	if(cycles < s->min)
+		s->min = cycles;
+	if(cycles > s->max)
+		s->max = cycles;
+	
+	bin = 31 - __CLZ(cycles | 1);
+	s->hist[bin < PROFILE_BINS ? bin : PROFILE_BINS - 1]++;
+}
+
+// Add the cycles since start to the record for id
+void ProfileRecord(int id, uint32_t start) {
+	
+	statAdd(&stats[id], DWT->CYCCNT - start);
+}
+
+void ProfileExit(int id, uint32_t start) {
+	
+	ProfileRecord(id, start);
+	--nesting;
+	
+	if(((id == PROF_TIM4) || (id == PROF_ADC)) && NVIC_GetPendingIRQ(OTG_FS_IRQn))
+		latency.held++;
+}
+
+// Called at entry of the USB handler, entry is the cycle count then
+void ProfileSOF(uint32_t entry) {
+	
+	uint32_t	nominal = SystemCoreClock / 1000, period, interval, late;
+	int32_t		err, step = (nominal << 8) / 1000;
+	int			bin;
+	
+	if(!(USB_OTG_FS->GINTSTS & USB_OTG_GINTSTS_SOF))
+		return;
+	
+	interval = entry - lastSOF;
+	lastSOF = entry;
+	
+	// Skip the first SOF and the ones after a missed SOF or a suspend
+	if(!sofCount || (interval > nominal + nominal / 2)) {
+		if(!sofCount++)
+			periodQ8 = nominal << 8;
+		return;
+	}
+	
+	period = periodQ8 >> 8;
+	late = interval > period ? interval - period : 0;
+	
+	// Move the mean by 1/64 of the error, limited to 1000 ppm so that a
+	// late SOF hardly shifts it
+	err = (int32_t)(interval << 8) - (int32_t)periodQ8;
+	err = err > step ? step : (err < -step ? -step : err);
+	periodQ8 += err / 64;
+	
+	if(sofCount < PROFILE_SOF_SETTLE) {
+		sofCount++;
+		return;
+	}
+	
+	latency.count++;
+	if(late > latency.max)
+		latency.max = late;
+	
+	if(NVIC_GetActive(TIM4_IRQn) || NVIC_GetActive(DMA2_Stream0_IRQn)) {
+		latency.preempted++;
+		if(late > latency.maxPreempted)
+			latency.maxPreempted = late;
+	}
+	
+	bin = 31 - __CLZ(late | 1);
+	latency.hist[bin < PROFILE_BINS ? bin : PROFILE_BINS - 1]++;
+}
+
+// Clear the ProfileBus record and run copies copies from now on
+void ProfileBusStart(int copies) {
+	
+	__disable_irq();
+	memset(&bus, 0, sizeof(bus));
+	bus.stat.min = 0xffffffff;
+	bus.pending = copies;
+	__enable_irq();
+}
+
+// Called from the main loop. Times one copy per ms while copies are
+// pending. Interrupts stay on during the copy, and a handler that ran in
+// it would add its own cycles, so the copy is then discarded. The DSB
+// waits for the last stores to reach the SRAM before the count is read.
+void ProfileBus(void) {
+	
+	uint32_t	start, cycles, n;
+	
+	if(!bus.pending || (getUptime() == lastCopy))
+		return;
+	lastCopy = getUptime();
+	
+	n = entries;
+	start = DWT->CYCCNT;
+	memcpy(copyDst, copySrc, sizeof(copyDst));
+	__DSB();
+	cycles = DWT->CYCCNT - start;
+	
+	// The record is read from the USB interrupt
+	__disable_irq();
+	if(bus.pending) {
+		bus.pending--;
+		if(entries != n)
+			bus.discarded++;
+		else
+			statAdd(&bus.stat, cycles);
+	}
+	__enable_irq();
+}
+
+// Point data to the record for handler id, to the summary when id is
+// PROF_COUNT, to the ProfileBus record when it is PROF_MEMCPY or to the
+// USB latency when it is PROF_LATENCY. Returns the length, 0 if there is
+// no such record.
+int ProfileGet(int id, const void **data) {
+	
+	int		len = sizeof(struct profile_stat);
+	
+	if((id < 0) || (id > PROF_LATENCY))
+		return 0;
+	
+	__disable_irq();
+	if(id == PROF_MEMCPY) {
+		snapshot.bus = bus;
+		len = sizeof(struct profile_bus);
+	}
+	else if(id == PROF_LATENCY) {
+		snapshot.latency = latency;
+		snapshot.latency.period = periodQ8 >> 8;
+		snapshot.latency.limit = SystemCoreClock / 1000000 * PROFILE_LATENCY_US;
+		if(latency.held || (latency.maxPreempted > snapshot.latency.limit))
+			snapshot.latency.result = PROFILE_FAIL;
+		else if(latency.preempted)
+			snapshot.latency.result = PROFILE_PASS;
+		else
+			snapshot.latency.result = PROFILE_PENDING;
+		len = sizeof(struct profile_latency);
+	}
+	else if(id == PROF_COUNT) {
+		snapshot.summary.handlers = PROF_COUNT;
+		snapshot.summary.maxNesting = maxNesting;
+		snapshot.summary.bins = PROFILE_BINS;
+		snapshot.summary.clock = SystemCoreClock;
+		len = sizeof(struct profile_summary);
+	}
+	else
+		snapshot.stat = stats[id];
+	__enable_irq();
+	
+	*data = &snapshot;
+	
+	return len;
+}
+
+#else
+
+void ProfileInit(void) {
+}
+
+void ProfileReset(void) {
+}
+
+void ProfileBus(void) {
+}
+
+int ProfileGet(__attribute__((unused)) int id, __attribute__((unused)) const void **data) {
+	
+	return 0;
+}
+
+#endif
@@ -0,0 +1,113 @@
+#ifndef PROFILE_H_
+#define	PROFILE_H_
+
+// Interrupt handler profiling with the DWT cycle counter. Build with
+// -D ISR_PROFILE to enable. Durations are from entry to exit of a handler,
+// including the time spent in higher priority handlers that preempt it.
+// PROFILE_MASK and PROFILE_UNMASK time a section with interrupts masked.
+// ProfileBus times a memcpy in SRAM from the main loop, once per ms for as
+// many copies as VENDOR_PROFILE_BUS asks for. A copy during which a handler
+// ran is discarded, so only the bus cycles taken by the DMA streams add to
+// the record. Compare the record while streaming with the one while idle.
+
+#define PROF_OTG		0
+#define PROF_DMA		1
+#define PROF_ADC		2
+#define PROF_TIM4		3
+#define PROF_TIM5		4
+#define PROF_PENDSV		5
+#define PROF_MASKED		6	// Interrupts masked at the end of a sampling frequency switch
+#define PROF_COUNT		7
+#define PROF_MEMCPY		(PROF_COUNT + 1)	// ProfileGet id of the ProfileBus record
+#define PROF_LATENCY	(PROF_COUNT + 2)	// ProfileGet id of the USB latency record
+
+#define PROFILE_COPY	1024	// Bytes copied by ProfileBus
+
+#define PROFILE_BINS	16	// Log2 histogram bins
+
+// The records are sent as they are with VENDOR_GET_PROFILE, so they are
+// packed
+
+struct profile_stat {
+	uint32_t	count;
+	uint32_t	min;				// Cycles
+	uint32_t	max;
+	uint64_t	sum;
+	uint32_t	hist[PROFILE_BINS];	// Bin n counts durations of 2^n to 2^(n+1) - 1 cycles, the last bin all above
+} __attribute__((packed));
+
+struct profile_summary {
+	uint8_t		handlers;			// PROF_COUNT
+	uint8_t		maxNesting;			// Deepest handler nesting seen
+	uint16_t	bins;				// PROFILE_BINS
+	uint32_t	clock;				// Core clock in Hz
+} __attribute__((packed));
+
+struct profile_bus {
+	uint32_t			pending;	// Copies still to run
+	uint32_t			discarded;	// Copies during which a handler ran, not in stat
+	struct profile_stat	stat;		// Cycles of the other copies
+} __attribute__((packed));
+
+// USB interrupt latency. The host sends a SOF every millisecond, so the
+// time between two SOF interrupts beyond the mean interval is how much
+// later the second was taken than the first. The mean follows the drift
+// of the core clock against the host. held counts the LED ramp and ADC
+// handlers that returned with the USB interrupt pending, which the
+// priorities in irq_prio.h should keep at zero.
+//
+// result is PROFILE_FAIL once a handler held the USB interrupt or a SOF
+// taken while one was running was more than limit cycles late, else
+// PROFILE_PASS after at least one such SOF.
+struct profile_latency {
+	uint32_t	count;				// SOF intervals measured
+	uint32_t	max;				// Cycles beyond the mean interval
+	uint32_t	preempted;			// SOFs taken while the LED ramp or ADC handler was running
+	uint32_t	maxPreempted;		// Cycles beyond the mean interval for those
+	uint32_t	held;
+	uint32_t	period;				// Mean SOF interval in cycles
+	uint32_t	limit;				// PROFILE_LATENCY_US in cycles
+	uint32_t	result;
+	uint32_t	hist[PROFILE_BINS];	// As for profile_stat
+} __attribute__((packed));
+
+#define PROFILE_PENDING	0
+#define PROFILE_PASS	1
+#define PROFILE_FAIL	2
+
+// Latency allowed for a SOF that preempts the LED ramp or ADC handler.
+// Covers the exception entry, the I2S DMA handler that may run first and
+// the SOF jitter of the host.
+#ifndef PROFILE_LATENCY_US
+#define PROFILE_LATENCY_US	10
+#endif
+
+// SOF intervals for the mean interval to settle before latencies count
+#define PROFILE_SOF_SETTLE	1000
+
+#ifdef ISR_PROFILE
+#define PROFILE_ENTER()		uint32_t profStart = ProfileEnter()
+#define PROFILE_EXIT(id)	ProfileExit(id, profStart)
+#define PROFILE_SOF()		ProfileSOF(profStart)
+#define PROFILE_MASK()		uint32_t profMask = ProfileCycles()
+#define PROFILE_UNMASK(id)	ProfileRecord(id, profMask)
+#else
+#define PROFILE_ENTER()
+#define PROFILE_EXIT(id)
+#define PROFILE_SOF()
+#define PROFILE_MASK()
+#define PROFILE_UNMASK(id)
+#endif
+
+void ProfileInit(void);
+void ProfileReset(void);
+uint32_t ProfileEnter(void);
+void ProfileExit(int id, uint32_t start);
+uint32_t ProfileCycles(void);
+void ProfileRecord(int id, uint32_t start);
+void ProfileSOF(uint32_t entry);
+void ProfileBusStart(int copies);
+void ProfileBus(void);
+int ProfileGet(int id, const void **data);
+
+#endif
@@ -10,7 +10,6 @@ void ShutdownCtlInit(void) {
 	EXTI->IMR |= EXTI_IMR_MR16;
 	EXTI->RTSR |= EXTI_RTSR_TR16;
 	
-	NVIC_SetPriority(PVD_IRQn, 0);
 	NVIC_EnableIRQ(PVD_IRQn);
 }
 
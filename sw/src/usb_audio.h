@@ -277,6 +277,34 @@ struct usb_audio_as_formatI_int_desc {
 	
 }  __attribute__ ((packed));
 
+// Same with the 176.4 kHz rate of the 16-bit alternate setting
+struct usb_audio_as_formatI_int5_desc {
+	uint8_t			bLength;
+	uint8_t			bDescriptorType;
+	uint8_t			bDescriptorSubtype;
+	uint8_t			bFormatType;
+	uint8_t			bNrChannels;
+	uint8_t			bSubFrameSize;
+	uint8_t			bBitResolution;
+	uint8_t			bSamFreqType;
+	struct byte3	tSamFreq[5];
+	
+}  __attribute__ ((packed));
+
+// Same with the two rates of the 32-bit container alternate setting
+struct usb_audio_as_formatI_int2_desc {
+	uint8_t			bLength;
+	uint8_t			bDescriptorType;
+	uint8_t			bDescriptorSubtype;
+	uint8_t			bFormatType;
+	uint8_t			bNrChannels;
+	uint8_t			bSubFrameSize;
+	uint8_t			bBitResolution;
+	uint8_t			bSamFreqType;
+	struct byte3	tSamFreq[2];
+	
+}  __attribute__ ((packed));
+
 // Standard AS Isochronous Audio Data Endpoint Descriptor
 struct usb_audio_as_iso_std_endp_desc {
 	uint8_t		bLength;
@@ -311,6 +339,128 @@ struct usb_audio_as_iso_synch_endp_desc {
 	uint8_t		bSynchAddress;
 } __attribute__ ((packed));
 
+// USB Audio class 2.0
+#define USB_AUDIO2_FUNCTION_SUBCLASS_UNDEFINED	0x00
+#define USB_AUDIO2_PROTO_IP_VERSION_02_00	0x20
+#define USB_AUDIO2_FUNCTION_OTHER			0xFF
+
+// USB Audio class 2.0 audio control interface descriptor subtypes
+#define USB_AUDIO2_CLOCK_SOURCE				0x0A
+
+// USB Audio class 2.0 request codes
+#define USB_AUDIO2_CUR						0x01
+#define USB_AUDIO2_RANGE					0x02
+
+// USB Audio class 2.0 clock source control selectors
+#define USB_AUDIO2_CS_SAM_FREQ_CONTROL		0x01
+#define USB_AUDIO2_CS_CLOCK_VALID_CONTROL	0x02
+
+// USB Audio class 2.0 control bit pairs
+#define USB_AUDIO2_CONTROL_RO				0x01
+#define USB_AUDIO2_CONTROL_RW				0x03
+
+#define USB_AUDIO2_CLOCK_INTERNAL_PROG		0x03
+
+struct usb_audio2_header_desc {
+	uint8_t		bLength;
+	uint8_t		bDescriptorType;
+	uint8_t		bDescriptorSubtype;
+	uint16_t	bcdADC;
+	uint8_t		bCategory;
+	uint16_t	wTotalLength;
+	uint8_t		bmControls;
+} __attribute__ ((packed));
+
+struct usb_audio2_clock_source_desc {
+	uint8_t		bLength;
+	uint8_t		bDescriptorType;
+	uint8_t		bDescriptorSubtype;
+	uint8_t		bClockID;
+	uint8_t		bmAttributes;
+	uint8_t		bmControls;
+	uint8_t		bAssocTerminal;
+	uint8_t		iClockSource;
+} __attribute__ ((packed));
+
+struct usb_audio2_input_terminal_desc {
+	uint8_t		bLength;
+	uint8_t		bDescriptorType;
+	uint8_t		bDescriptorSubtype;
+	uint8_t		bTerminalID;
+	uint16_t	wTerminalType;
+	uint8_t		bAssocTerminal;
+	uint8_t		bCSourceID;
+	uint8_t		bNrChannels;
+	uint32_t	bmChannelConfig;
+	uint8_t		iChannelNames;
+	uint16_t	bmControls;
+	uint8_t		iTerminal;
+} __attribute__ ((packed));
+
+struct usb_audio2_output_terminal_desc {
+	uint8_t		bLength;
+	uint8_t		bDescriptorType;
+	uint8_t		bDescriptorSubtype;
+	uint8_t		bTerminalID;
+	uint16_t	wTerminalType;
+	uint8_t		bAssocTerminal;
+	uint8_t		bSourceID;
+	uint8_t		bCSourceID;
+	uint16_t	bmControls;
+	uint8_t		iTerminal;
+} __attribute__ ((packed));
+
+// Master and two channels, two bits per control
+struct usb_audio2_feature_unit_desc {
+	uint8_t		bLength;
+	uint8_t		bDescriptorType;
+	uint8_t		bDescriptorSubtype;
+	uint8_t		bUnitID;
+	uint8_t		bSourceID;
+	uint32_t	bmaControls[3];
+	uint8_t		iFeature;
+} __attribute__ ((packed));
+
+struct usb_audio2_as_spec_int_desc {
+	uint8_t		bLength;
+	uint8_t		bDescriptorType;
+	uint8_t		bDescriptorSubtype;
+	uint8_t		bTerminalLink;
+	uint8_t		bmControls;
+	uint8_t		bFormatType;
+	uint32_t	bmFormats;
+	uint8_t		bNrChannels;
+	uint32_t	bmChannelConfig;
+	uint8_t		iChannelNames;
+} __attribute__ ((packed));
+
+struct usb_audio2_as_formatI_int_desc {
+	uint8_t		bLength;
+	uint8_t		bDescriptorType;
+	uint8_t		bDescriptorSubtype;
+	uint8_t		bFormatType;
+	uint8_t		bSubslotSize;
+	uint8_t		bBitResolution;
+} __attribute__ ((packed));
+
+struct usb_audio2_as_iso_spec_endp_desc {
+	uint8_t		bLength;
+	uint8_t		bDescriptorType;
+	uint8_t		bDescriptorSubtype;
+	uint8_t		bmAttributes;
+	uint8_t		bmControls;
+	uint8_t		bLockDelayUnits;
+	uint16_t	wLockDelay;
+} __attribute__ ((packed));
+
+// Interrupt data message sent on the audio control interrupt endpoint
+struct usb_audio2_interrupt_data {
+	uint8_t		bInfo;
+	uint8_t		bAttribute;
+	uint16_t	wValue;
+	uint16_t	wIndex;
+} __attribute__ ((packed));
+
 #ifdef __cplusplus
     }
 #endif
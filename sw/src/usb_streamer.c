@@ -26,22 +26,48 @@
 #endif
 #include "debounce.h"
 #include "audio.h"
+#include "pcm.h"
 #include "usb.h"
 #include "usb_hid.h"
 #include "usb_audio.h"
 #include "usb_streamer.h"
+#include "feedback.h"
+#include "profile.h"
+#include "utils.h"
 
 // USB related
 #define UAC_EP0_SIZE	64
 #define EP_OUT			0x01
 #define EP_IN			0x82
 #define EP_SIZE			(SAMPLES96000 * 3 * 2 + 6)
+#define EP_SIZE16		(SAMPLES176400 * 2 * 2 + 4)	// Alternate setting 2, 16-bit samples up to 176.4 kHz
+#define EP_SIZE32		(SAMPLES48000 * 4 * 2 + 8)	// Alternate setting 3, 32-bit containers up to 48 kHz
 
-#define FB_RATE			2
+#ifdef USB_UAC2
+// UAC2 entities and the audio control interrupt endpoint
+#define UAC2_FEATURE_ID	2
+#define UAC2_CLOCK_ID	4
+#define AC_INT_EP		0x81
+#define AC_INT_SZ		6
+#endif
 
 // HID stuff
 #define HID_RIN_EP      0x83
 #define HID_RIN_SZ      0x10
+#define HID_EVENT_AGE	1000	// ms, older button events are dropped
+
+// Vendor requests, device recipient
+#define VENDOR_SET_LATENCY	0x01	// wValue: latency in ms
+#define VENDOR_GET_LATENCY	0x02	// Reply: latency in ms, 16 bits
+#define VENDOR_SET_DITHER	0x03	// wValue: DITHER_OFF ... DITHER_SHAPE2
+#define VENDOR_GET_DITHER	0x04
+#define VENDOR_GET_PROFILE	0x05	// wIndex: handler, PROF_COUNT for the summary, PROF_MEMCPY for the ProfileBus copies, PROF_LATENCY for the USB latency. Needs ISR_PROFILE
+#define VENDOR_RESET_PROFILE	0x06
+#define VENDOR_GET_TELEMETRY	0x07	// struct telemetry
+#define VENDOR_RESET_TELEMETRY	0x08
+#define VENDOR_PROFILE_BUS	0x09	// wValue: number of ProfileBus copies, one per ms. Needs ISR_PROFILE
+
+#define FILL_BINS		16		// Buffer fill histogram bins
 
 #define AUDIO_SAMPLE_FREQ(frq) (uint8_t)(frq), (uint8_t)((frq >> 8)), (uint8_t)((frq >> 16))
 
@@ -77,6 +103,7 @@ static struct {
     uint8_t     buttons;
 } __attribute__((packed)) hid_report_data;
 
+#ifndef USB_UAC2
 // Audio device configuration descriptor
 struct audio_config {
 	struct usb_config_descriptor			config;
@@ -93,18 +120,111 @@ struct audio_config {
 	struct usb_audio_as_iso_std_endp_desc	ep1;
 	struct usb_audio_as_iso_spec_endp_desc	ep1_as;
 	struct usb_audio_as_iso_synch_endp_desc	ep2;
+	struct usb_audio_as_std_int_desc		as_std_interface2;
+	struct usb_audio_as_spec_int_desc		as_spec_interface2;
+	struct usb_audio_as_formatI_int5_desc	as2;
+	struct usb_audio_as_iso_std_endp_desc	ep1_2;
+	struct usb_audio_as_iso_spec_endp_desc	ep1_as2;
+	struct usb_audio_as_iso_synch_endp_desc	ep2_2;
+	struct usb_audio_as_std_int_desc		as_std_interface3;
+	struct usb_audio_as_spec_int_desc		as_spec_interface3;
+	struct usb_audio_as_formatI_int2_desc	as3;
+	struct usb_audio_as_iso_std_endp_desc	ep1_3;
+	struct usb_audio_as_iso_spec_endp_desc	ep1_as3;
+	struct usb_audio_as_iso_synch_endp_desc	ep2_3;
+	
+	struct usb_interface_descriptor			hid_interface;
+	struct usb_hid_descriptor				hid_desc;
+	struct usb_endpoint_descriptor			hid_epIn;
+	
+} __attribute__((packed));
+#else
+// Audio device configuration descriptor
+struct audio_config {
+	struct usb_config_descriptor			config;
+	struct usb_iad_descriptor				iad;
+	struct usb_interface_descriptor			audio_interface;
+	struct usb_audio2_header_desc			ac_interface;
+	struct usb_audio2_clock_source_desc		clock_source;
+	struct usb_audio2_input_terminal_desc	input_terminal;
+	struct usb_audio2_feature_unit_desc		audio_feature;
+	struct usb_audio2_output_terminal_desc	output_terminal;
+	struct usb_endpoint_descriptor			ac_int_ep;
+	struct usb_audio_as_std_int_desc		as_std_interface0;
+	struct usb_audio_as_std_int_desc		as_std_interface1;
+	struct usb_audio2_as_spec_int_desc		as_spec_interface1;
+	struct usb_audio2_as_formatI_int_desc	as1;
+	struct usb_endpoint_descriptor			ep1;
+	struct usb_audio2_as_iso_spec_endp_desc	ep1_as;
+	struct usb_endpoint_descriptor			ep2;
+	struct usb_audio_as_std_int_desc		as_std_interface2;
+	struct usb_audio2_as_spec_int_desc		as_spec_interface2;
+	struct usb_audio2_as_formatI_int_desc	as2;
+	struct usb_endpoint_descriptor			ep1_2;
+	struct usb_audio2_as_iso_spec_endp_desc	ep1_as2;
+	struct usb_endpoint_descriptor			ep2_2;
+	struct usb_audio_as_std_int_desc		as_std_interface3;
+	struct usb_audio2_as_spec_int_desc		as_spec_interface3;
+	struct usb_audio2_as_formatI_int_desc	as3;
+	struct usb_endpoint_descriptor			ep1_3;
+	struct usb_audio2_as_iso_spec_endp_desc	ep1_as3;
+	struct usb_endpoint_descriptor			ep2_3;
 	
 	struct usb_interface_descriptor			hid_interface;
 	struct usb_hid_descriptor				hid_desc;
 	struct usb_endpoint_descriptor			hid_epIn;
 	
 } __attribute__((packed));
+#endif
 
 volatile FeedbackData	fbData;
+FeedbackPI				fbPI;
 usbd_device 			udev;
 uint32_t				ubuf[0x20];
-uint8_t					tmpBuf[EP_SIZE*2];
 int						playing;
+static volatile int		pendingFs = 0; // Sampling frequency switch in progress, see PendSV_Handler
+static int				hidIdle = 0; // No HID report queued, the next button event is sent at SOF
+static uint8_t			hidHeld = 0; // Scan buttons with a long press in progress
+
+// Stream health counters, read with VENDOR_GET_TELEMETRY
+struct telemetry {
+	uint32_t	underruns;
+	uint32_t	overruns;
+	uint32_t	incomplOut;				// Incomplete isochronous OUT frames
+	uint32_t	incomplIn;				// Incomplete isochronous IN frames
+	uint32_t	shortPackets;			// Fewer frames than the nominal rate, or a partial frame
+	uint32_t	fbClamps;				// Feedback limited to fbDefault +- FB_LIMIT
+	uint32_t	polls;					// USB interrupt entries, from usbd_poll_stats
+	uint32_t	pollEvents;				// Events handled in them
+	uint32_t	pollMax;				// Most events handled in one entry
+	uint32_t	oversize;				// Packets larger than the alternate setting allows, dropped
+	uint32_t	fillHist[FILL_BINS];	// SOFs per fill level, bin n is n/FILL_BINS to (n+1)/FILL_BINS of the buffer
+} __attribute__((packed));
+
+static struct telemetry	telemetry, telemetrySnapshot;
+
+// Largest packet and highest sampling frequency of each alternate setting
+// of the streaming interface. 1 is 24-bit, 2 is 16-bit, 3 is 32-bit.
+static const struct {
+	uint16_t	packet;
+	int			maxFs;
+} altLimits[] = {
+	{0,			0},
+	{EP_SIZE,	96000},
+	{EP_SIZE16,	176400},
+	{EP_SIZE32,	48000},
+};
+
+#ifdef USB_UAC2
+// Clock source sampling frequency changed, sent on the interrupt endpoint
+static volatile int		clockChanged = 0;
+static const struct usb_audio2_interrupt_data	clockInterrupt = {
+	.bInfo					= 0,	// Class specific, interface
+	.bAttribute				= USB_AUDIO2_CUR,
+	.wValue					= USB_AUDIO2_CS_SAM_FREQ_CONTROL << 8,
+	.wIndex					= UAC2_CLOCK_ID << 8,
+};
+#endif
 #ifdef DEBUG
 int						debugCount = 0;
 #endif
@@ -127,6 +247,7 @@ static const struct usb_device_descriptor	device_desc = {
 	.bNumConfigurations	= 1,
 };
 
+#ifndef USB_UAC2
 // Device configuration descriptor
 static const struct audio_config	config_desc = {
 	.config = { // Configuration 1
@@ -191,7 +312,7 @@ static const struct audio_config	config_desc = {
     	.bUnitID				= 2,
     	.bSourceID				= 1,
     	.bControlSize			= 2,
-    	.bmaControls			= {1, 0, 0},
+    	.bmaControls			= {USB_AUDIO_FU_MUTE_CONTROL | USB_AUDIO_FU_VOLUME_CONTROL, 0, 0},
     	.iFeature				= 0,
     },
     .output_terminal = { // USB speaker output terminal descriptor
@@ -279,6 +400,418 @@ static const struct audio_config	config_desc = {
 		.bSynchAddress			= 0,
 	},
 	
+	.as_std_interface2 = { // Standard AS interface descriptor, alternate setting 2
+	                   // 16-bit samples
+		.bLength				= sizeof(struct usb_audio_as_std_int_desc),
+		.bDescriptorType		= USB_DTYPE_INTERFACE,
+		.bInterfaceNumber		= 1,
+		.bAlternateSetting		= 2,
+		.bNumEndpoints			= 2,
+		.bInterfaceClass		= USB_CLASS_AUDIO,
+		.bInterfaceSubClass		= USB_AUDIO_SUBCLASS_AUDIOSTREAMING,
+		.bInterfaceProtocol		= USB_AUDIO_PROTO_UNDEFINED,
+		.iInterface				= 0,
+	},
+	.as_spec_interface2 = { // USB speaker Audio streaming interface descriptor
+		.bLength				= sizeof(struct usb_audio_as_spec_int_desc),
+		.bDescriptorType		= USB_AUDIO_CS_INTERFACE,
+		.bDescriptorSubtype		= USB_AUDIO_AS_GENERAL,
+		.bTerminalLink			= 1,
+		.bDelay					= 1,
+		.wFormatTag				= USB_AUDIO_DATA_FORMAT_PCM,
+	},
+	.as2 = { // USB speaker Audio type I format interface descriptor
+		.bLength				= sizeof(struct usb_audio_as_formatI_int5_desc),
+		.bDescriptorType		= USB_AUDIO_CS_INTERFACE,
+		.bDescriptorSubtype		= USB_AUDIO_FORMAT_TYPE,
+		.bFormatType			= USB_AUDIO_FORMAT_TYPE_I,
+		.bNrChannels			= 2,
+		.bSubFrameSize			= 2,
+		.bBitResolution			= 16,
+		.bSamFreqType			= 5,
+		.tSamFreq				= {{AUDIO_SAMPLE_FREQ(44100)},
+								   {AUDIO_SAMPLE_FREQ(48000)},
+								   {AUDIO_SAMPLE_FREQ(88200)},
+								   {AUDIO_SAMPLE_FREQ(96000)},
+								   {AUDIO_SAMPLE_FREQ(176400)}},
+	},
+	.ep1_2 = { // Endpoint 1 standard descriptor, 16-bit
+		.bLength				= sizeof(struct usb_audio_as_iso_std_endp_desc),
+		.bDescriptorType		= USB_DTYPE_ENDPOINT,
+		.bEndpointAddress		= EP_OUT,
+		.bmAttributes			= 0x05, // 0b00000101, asynchronous isochronous
+		.wMaxPacketSize			= EP_SIZE16,
+		.bInterval				= 1,
+		.bRefresh				= 0,
+		.bSynchAddress			= EP_IN,
+	},
+	.ep1_as2 = { // Endpoint, Audio class specific streaming descriptor
+		.bLength				= sizeof(struct usb_audio_as_iso_spec_endp_desc),
+		.bDescriptorType		= USB_AUDIO_CS_ENDPOINT,
+		.bDescriptorSubtype		= USB_AUDIO_EP_GENERAL,
+		.bmAttributes			= 0x01,
+		.bLockDelayUnits		= 0x00,
+		.wLockDelay				= 0x0000,
+	},
+	.ep2_2 = { // Standard AS isochronous synch endpoint
+		.bLength				= sizeof(struct usb_audio_as_iso_synch_endp_desc),
+		.bDescriptorType		= USB_DTYPE_ENDPOINT,
+		.bEndpointAddress		= EP_IN,
+		.bmAttributes			= 0x11, // Isochronous feedback endpoint
+		.wMaxPacketSize			= 0x0003,
+		.bInterval				= 0x01,
+		.bRefresh				= FB_RATE, // Power of 2. Refresh rate is 2^(10-8) = 2^2 = 4
+		.bSynchAddress			= 0,
+	},
+	
+	.as_std_interface3 = { // Standard AS interface descriptor, alternate setting 3
+	                   // 24-bit samples in 32-bit containers
+		.bLength				= sizeof(struct usb_audio_as_std_int_desc),
+		.bDescriptorType		= USB_DTYPE_INTERFACE,
+		.bInterfaceNumber		= 1,
+		.bAlternateSetting		= 3,
+		.bNumEndpoints			= 2,
+		.bInterfaceClass		= USB_CLASS_AUDIO,
+		.bInterfaceSubClass		= USB_AUDIO_SUBCLASS_AUDIOSTREAMING,
+		.bInterfaceProtocol		= USB_AUDIO_PROTO_UNDEFINED,
+		.iInterface				= 0,
+	},
+	.as_spec_interface3 = { // USB speaker Audio streaming interface descriptor
+		.bLength				= sizeof(struct usb_audio_as_spec_int_desc),
+		.bDescriptorType		= USB_AUDIO_CS_INTERFACE,
+		.bDescriptorSubtype		= USB_AUDIO_AS_GENERAL,
+		.bTerminalLink			= 1,
+		.bDelay					= 1,
+		.wFormatTag				= USB_AUDIO_DATA_FORMAT_PCM,
+	},
+	.as3 = { // USB speaker Audio type I format interface descriptor
+		.bLength				= sizeof(struct usb_audio_as_formatI_int2_desc),
+		.bDescriptorType		= USB_AUDIO_CS_INTERFACE,
+		.bDescriptorSubtype		= USB_AUDIO_FORMAT_TYPE,
+		.bFormatType			= USB_AUDIO_FORMAT_TYPE_I,
+		.bNrChannels			= 2,
+		.bSubFrameSize			= 4,
+		.bBitResolution			= 24,
+		.bSamFreqType			= 2,
+		.tSamFreq				= {{AUDIO_SAMPLE_FREQ(44100)},
+								   {AUDIO_SAMPLE_FREQ(48000)}},
+	},
+	.ep1_3 = { // Endpoint 1 standard descriptor, 32-bit containers
+		.bLength				= sizeof(struct usb_audio_as_iso_std_endp_desc),
+		.bDescriptorType		= USB_DTYPE_ENDPOINT,
+		.bEndpointAddress		= EP_OUT,
+		.bmAttributes			= 0x05, // 0b00000101, asynchronous isochronous
+		.wMaxPacketSize			= EP_SIZE32,
+		.bInterval				= 1,
+		.bRefresh				= 0,
+		.bSynchAddress			= EP_IN,
+	},
+	.ep1_as3 = { // Endpoint, Audio class specific streaming descriptor
+		.bLength				= sizeof(struct usb_audio_as_iso_spec_endp_desc),
+		.bDescriptorType		= USB_AUDIO_CS_ENDPOINT,
+		.bDescriptorSubtype		= USB_AUDIO_EP_GENERAL,
+		.bmAttributes			= 0x01,
+		.bLockDelayUnits		= 0x00,
+		.wLockDelay				= 0x0000,
+	},
+	.ep2_3 = { // Standard AS isochronous synch endpoint
+		.bLength				= sizeof(struct usb_audio_as_iso_synch_endp_desc),
+		.bDescriptorType		= USB_DTYPE_ENDPOINT,
+		.bEndpointAddress		= EP_IN,
+		.bmAttributes			= 0x11, // Isochronous feedback endpoint
+		.wMaxPacketSize			= 0x0003,
+		.bInterval				= 0x01,
+		.bRefresh				= FB_RATE, // Power of 2. Refresh rate is 2^(10-8) = 2^2 = 4
+		.bSynchAddress			= 0,
+	},
+	
+#else
+// Device configuration descriptor
+static const struct audio_config	config_desc = {
+	.config = { // Configuration 1
+		.bLength				= sizeof(struct usb_config_descriptor),
+    	.bDescriptorType		= USB_DTYPE_CONFIGURATION,
+    	.wTotalLength			= sizeof(struct audio_config),
+    	.bNumInterfaces			= 3,
+    	.bConfigurationValue	= 1,
+    	.iConfiguration			= NO_DESCRIPTOR,
+    	.bmAttributes			= USB_CFG_ATTR_RESERVED | USB_CFG_ATTR_SELFPOWERED,
+    	.bMaxPower				= USB_CFG_POWER_MA(500),
+    },
+    .iad = {
+    	.bLength				= sizeof(struct usb_iad_descriptor),
+    	.bDescriptorType		= USB_DTYPE_INTERFACEASSOC,
+    	.bFirstInterface		= 0,
+    	.bInterfaceCount		= 3,
+    	.bFunctionClass			= USB_CLASS_AUDIO,
+    	.bFunctionSubClass		= USB_AUDIO2_FUNCTION_SUBCLASS_UNDEFINED,
+    	.bFunctionProtocol		= USB_AUDIO2_PROTO_IP_VERSION_02_00,
+    	.iFunction				= 0,
+    },
+    .audio_interface = { // Standard Audio Control interface descriptor, with the interrupt endpoint
+    	.bLength				= sizeof(struct usb_interface_descriptor),
+    	.bDescriptorType		= USB_DTYPE_INTERFACE,
+    	.bInterfaceNumber		= 0,
+    	.bAlternateSetting		= 0,
+    	.bNumEndpoints			= 1,
+    	.bInterfaceClass		= USB_CLASS_AUDIO,
+    	.bInterfaceSubClass		= USB_AUDIO_SUBCLASS_AUDIOCONTROL,
+    	.bInterfaceProtocol		= USB_AUDIO2_PROTO_IP_VERSION_02_00,
+    	.iInterface				= 0,
+    },
+    .ac_interface = { // Class-specific Audio Control interface descriptor 
+    	.bLength				= sizeof(struct usb_audio2_header_desc),
+		.bDescriptorType		= USB_AUDIO_CS_INTERFACE,
+		.bDescriptorSubtype		= USB_AUDIO_HEADER,
+		.bcdADC					= VERSION_BCD(2,0,0),
+		.bCategory				= USB_AUDIO2_FUNCTION_OTHER,
+		.wTotalLength			= sizeof(struct usb_audio2_header_desc) +
+								  sizeof(struct usb_audio2_clock_source_desc) +
+								  sizeof(struct usb_audio2_input_terminal_desc) +
+								  sizeof(struct usb_audio2_feature_unit_desc) +
+								  sizeof(struct usb_audio2_output_terminal_desc),
+		.bmControls				= 0,
+    },
+    .clock_source = { // Internal clock, rate set by the host, validity read only
+    	.bLength				= sizeof(struct usb_audio2_clock_source_desc),
+    	.bDescriptorType		= USB_AUDIO_CS_INTERFACE,
+    	.bDescriptorSubtype		= USB_AUDIO2_CLOCK_SOURCE,
+    	.bClockID				= UAC2_CLOCK_ID,
+    	.bmAttributes			= USB_AUDIO2_CLOCK_INTERNAL_PROG,
+    	.bmControls				= USB_AUDIO2_CONTROL_RW | (USB_AUDIO2_CONTROL_RO << 2),
+    	.bAssocTerminal			= 0,
+    	.iClockSource			= 0,
+    },
+    .input_terminal = { // USB speaker input terminal descriptor
+    	.bLength				= sizeof(struct usb_audio2_input_terminal_desc),
+    	.bDescriptorType		= USB_AUDIO_CS_INTERFACE,
+    	.bDescriptorSubtype		= USB_AUDIO_INPUT_TERMINAL,
+    	.bTerminalID			= 1,
+    	.wTerminalType			= USB_AUDIO_TERMINAL_TYPE_STREAMING,
+    	.bAssocTerminal			= 0,
+    	.bCSourceID				= UAC2_CLOCK_ID,
+    	.bNrChannels			= 2,
+    	.bmChannelConfig		= 3,
+    	.iChannelNames			= 0,
+    	.bmControls				= 0,
+    	.iTerminal				= 0,
+    },
+    .audio_feature = { // Audio feature unit descriptor, master mute and volume
+    	.bLength				= sizeof(struct usb_audio2_feature_unit_desc),
+    	.bDescriptorType		= USB_AUDIO_CS_INTERFACE,
+    	.bDescriptorSubtype		= USB_AUDIO_FEATURE_UNIT,
+    	.bUnitID				= UAC2_FEATURE_ID,
+    	.bSourceID				= 1,
+    	.bmaControls			= {USB_AUDIO2_CONTROL_RW | (USB_AUDIO2_CONTROL_RW << 2), 0, 0},
+    	.iFeature				= 0,
+    },
+    .output_terminal = { // USB speaker output terminal descriptor
+    	.bLength				= sizeof(struct usb_audio2_output_terminal_desc),
+    	.bDescriptorType		= USB_AUDIO_CS_INTERFACE,
+    	.bDescriptorSubtype		= USB_AUDIO_OUTPUT_TERMINAL,
+    	.bTerminalID			= 3,
+    	.wTerminalType			= USB_AUDIO_TERMINAL_TYPE_HEADPHONE,
+    	.bAssocTerminal			= 0,
+    	.bSourceID				= UAC2_FEATURE_ID,
+    	.bCSourceID				= UAC2_CLOCK_ID,
+    	.bmControls				= 0,
+    	.iTerminal				= 0,
+    },
+    .ac_int_ep = { // Audio control interrupt endpoint, clock change notifications
+    	.bLength				= sizeof(struct usb_endpoint_descriptor),
+    	.bDescriptorType		= USB_DTYPE_ENDPOINT,
+    	.bEndpointAddress		= AC_INT_EP,
+    	.bmAttributes			= USB_EPTYPE_INTERRUPT,
+    	.wMaxPacketSize			= AC_INT_SZ,
+    	.bInterval				= 1,
+    },
+	.as_std_interface0 = { // Standard AS interface descriptor, interface 1, alternate setting 0
+	                   // Zero bandwidth, zero endpoints. Used when no audio is playing
+		.bLength				= sizeof(struct usb_audio_as_std_int_desc),
+		.bDescriptorType		= USB_DTYPE_INTERFACE,
+		.bInterfaceNumber		= 1,
+		.bAlternateSetting		= 0,
+		.bNumEndpoints			= 0,
+		.bInterfaceClass		= USB_CLASS_AUDIO,
+		.bInterfaceSubClass		= USB_AUDIO_SUBCLASS_AUDIOSTREAMING,
+		.bInterfaceProtocol		= USB_AUDIO2_PROTO_IP_VERSION_02_00,
+		.iInterface				= 0,
+	},
+	.as_std_interface1 = { // Standard AS interface descriptor, alternate setting 1
+	                   // Used when audio is playing
+		.bLength				= sizeof(struct usb_audio_as_std_int_desc),
+		.bDescriptorType		= USB_DTYPE_INTERFACE,
+		.bInterfaceNumber		= 1,
+		.bAlternateSetting		= 1,
+		.bNumEndpoints			= 2,
+		.bInterfaceClass		= USB_CLASS_AUDIO,
+		.bInterfaceSubClass		= USB_AUDIO_SUBCLASS_AUDIOSTREAMING,
+		.bInterfaceProtocol		= USB_AUDIO2_PROTO_IP_VERSION_02_00,
+		.iInterface				= 0,
+	},
+	.as_spec_interface1 = { // USB speaker Audio streaming interface descriptor
+		.bLength				= sizeof(struct usb_audio2_as_spec_int_desc),
+		.bDescriptorType		= USB_AUDIO_CS_INTERFACE,
+		.bDescriptorSubtype		= USB_AUDIO_AS_GENERAL,
+		.bTerminalLink			= 1,
+		.bmControls				= 0,
+		.bFormatType			= USB_AUDIO_FORMAT_TYPE_I,
+		.bmFormats				= USB_AUDIO_DATA_FORMAT_PCM,
+		.bNrChannels			= 2,
+		.bmChannelConfig		= 3,
+		.iChannelNames			= 0,
+	},
+	.as1 = { // USB speaker Audio type I format interface descriptor
+		.bLength				= sizeof(struct usb_audio2_as_formatI_int_desc),
+		.bDescriptorType		= USB_AUDIO_CS_INTERFACE,
+		.bDescriptorSubtype		= USB_AUDIO_FORMAT_TYPE,
+		.bFormatType			= USB_AUDIO_FORMAT_TYPE_I,
+		.bSubslotSize			= 3,
+		.bBitResolution			= 24,
+	},
+	.ep1 = { // Endpoint 1 standard descriptor
+		.bLength				= sizeof(struct usb_endpoint_descriptor),
+		.bDescriptorType		= USB_DTYPE_ENDPOINT,
+		.bEndpointAddress		= EP_OUT,
+		.bmAttributes			= 0x05, // 0b00000101, asynchronous isochronous
+		.wMaxPacketSize			= EP_SIZE,
+		.bInterval				= 1,
+	},
+	.ep1_as = { // Endpoint, Audio class specific streaming descriptor
+		.bLength				= sizeof(struct usb_audio2_as_iso_spec_endp_desc),
+		.bDescriptorType		= USB_AUDIO_CS_ENDPOINT,
+		.bDescriptorSubtype		= USB_AUDIO_EP_GENERAL,
+		.bmAttributes			= 0x00,
+		.bmControls				= 0x00,
+		.bLockDelayUnits		= 0x00,
+		.wLockDelay				= 0x0000,
+	},
+	.ep2 = { // Isochronous feedback endpoint, same 10.14 format as UAC1 at full speed
+		.bLength				= sizeof(struct usb_endpoint_descriptor),
+		.bDescriptorType		= USB_DTYPE_ENDPOINT,
+		.bEndpointAddress		= EP_IN,
+		.bmAttributes			= 0x11, // Isochronous feedback endpoint
+		.wMaxPacketSize			= 0x0003,
+		.bInterval				= FB_RATE + 1, // 2^(bInterval - 1) frames, same refresh as UAC1
+	},
+	
+	.as_std_interface2 = { // Standard AS interface descriptor, alternate setting 2
+	                   // 16-bit samples
+		.bLength				= sizeof(struct usb_audio_as_std_int_desc),
+		.bDescriptorType		= USB_DTYPE_INTERFACE,
+		.bInterfaceNumber		= 1,
+		.bAlternateSetting		= 2,
+		.bNumEndpoints			= 2,
+		.bInterfaceClass		= USB_CLASS_AUDIO,
+		.bInterfaceSubClass		= USB_AUDIO_SUBCLASS_AUDIOSTREAMING,
+		.bInterfaceProtocol		= USB_AUDIO2_PROTO_IP_VERSION_02_00,
+		.iInterface				= 0,
+	},
+	.as_spec_interface2 = { // USB speaker Audio streaming interface descriptor
+		.bLength				= sizeof(struct usb_audio2_as_spec_int_desc),
+		.bDescriptorType		= USB_AUDIO_CS_INTERFACE,
+		.bDescriptorSubtype		= USB_AUDIO_AS_GENERAL,
+		.bTerminalLink			= 1,
+		.bmControls				= 0,
+		.bFormatType			= USB_AUDIO_FORMAT_TYPE_I,
+		.bmFormats				= USB_AUDIO_DATA_FORMAT_PCM,
+		.bNrChannels			= 2,
+		.bmChannelConfig		= 3,
+		.iChannelNames			= 0,
+	},
+	.as2 = { // USB speaker Audio type I format interface descriptor
+		.bLength				= sizeof(struct usb_audio2_as_formatI_int_desc),
+		.bDescriptorType		= USB_AUDIO_CS_INTERFACE,
+		.bDescriptorSubtype		= USB_AUDIO_FORMAT_TYPE,
+		.bFormatType			= USB_AUDIO_FORMAT_TYPE_I,
+		.bSubslotSize			= 2,
+		.bBitResolution			= 16,
+	},
+	.ep1_2 = { // Endpoint 1 standard descriptor, 16-bit
+		.bLength				= sizeof(struct usb_endpoint_descriptor),
+		.bDescriptorType		= USB_DTYPE_ENDPOINT,
+		.bEndpointAddress		= EP_OUT,
+		.bmAttributes			= 0x05, // 0b00000101, asynchronous isochronous
+		.wMaxPacketSize			= EP_SIZE16,
+		.bInterval				= 1,
+	},
+	.ep1_as2 = { // Endpoint, Audio class specific streaming descriptor
+		.bLength				= sizeof(struct usb_audio2_as_iso_spec_endp_desc),
+		.bDescriptorType		= USB_AUDIO_CS_ENDPOINT,
+		.bDescriptorSubtype		= USB_AUDIO_EP_GENERAL,
+		.bmAttributes			= 0x00,
+		.bmControls				= 0x00,
+		.bLockDelayUnits		= 0x00,
+		.wLockDelay				= 0x0000,
+	},
+	.ep2_2 = { // Isochronous feedback endpoint, same 10.14 format as UAC1 at full speed
+		.bLength				= sizeof(struct usb_endpoint_descriptor),
+		.bDescriptorType		= USB_DTYPE_ENDPOINT,
+		.bEndpointAddress		= EP_IN,
+		.bmAttributes			= 0x11, // Isochronous feedback endpoint
+		.wMaxPacketSize			= 0x0003,
+		.bInterval				= FB_RATE + 1, // 2^(bInterval - 1) frames, same refresh as UAC1
+	},
+	
+	.as_std_interface3 = { // Standard AS interface descriptor, alternate setting 3
+	                   // 24-bit samples in 32-bit containers
+		.bLength				= sizeof(struct usb_audio_as_std_int_desc),
+		.bDescriptorType		= USB_DTYPE_INTERFACE,
+		.bInterfaceNumber		= 1,
+		.bAlternateSetting		= 3,
+		.bNumEndpoints			= 2,
+		.bInterfaceClass		= USB_CLASS_AUDIO,
+		.bInterfaceSubClass		= USB_AUDIO_SUBCLASS_AUDIOSTREAMING,
+		.bInterfaceProtocol		= USB_AUDIO2_PROTO_IP_VERSION_02_00,
+		.iInterface				= 0,
+	},
+	.as_spec_interface3 = { // USB speaker Audio streaming interface descriptor
+		.bLength				= sizeof(struct usb_audio2_as_spec_int_desc),
+		.bDescriptorType		= USB_AUDIO_CS_INTERFACE,
+		.bDescriptorSubtype		= USB_AUDIO_AS_GENERAL,
+		.bTerminalLink			= 1,
+		.bmControls				= 0,
+		.bFormatType			= USB_AUDIO_FORMAT_TYPE_I,
+		.bmFormats				= USB_AUDIO_DATA_FORMAT_PCM,
+		.bNrChannels			= 2,
+		.bmChannelConfig		= 3,
+		.iChannelNames			= 0,
+	},
+	.as3 = { // USB speaker Audio type I format interface descriptor
+		.bLength				= sizeof(struct usb_audio2_as_formatI_int_desc),
+		.bDescriptorType		= USB_AUDIO_CS_INTERFACE,
+		.bDescriptorSubtype		= USB_AUDIO_FORMAT_TYPE,
+		.bFormatType			= USB_AUDIO_FORMAT_TYPE_I,
+		.bSubslotSize			= 4,
+		.bBitResolution			= 24,
+	},
+	.ep1_3 = { // Endpoint 1 standard descriptor, 32-bit containers
+		.bLength				= sizeof(struct usb_endpoint_descriptor),
+		.bDescriptorType		= USB_DTYPE_ENDPOINT,
+		.bEndpointAddress		= EP_OUT,
+		.bmAttributes			= 0x05, // 0b00000101, asynchronous isochronous
+		.wMaxPacketSize			= EP_SIZE32,
+		.bInterval				= 1,
+	},
+	.ep1_as3 = { // Endpoint, Audio class specific streaming descriptor
+		.bLength				= sizeof(struct usb_audio2_as_iso_spec_endp_desc),
+		.bDescriptorType		= USB_AUDIO_CS_ENDPOINT,
+		.bDescriptorSubtype		= USB_AUDIO_EP_GENERAL,
+		.bmAttributes			= 0x00,
+		.bmControls				= 0x00,
+		.bLockDelayUnits		= 0x00,
+		.wLockDelay				= 0x0000,
+	},
+	.ep2_3 = { // Isochronous feedback endpoint, same 10.14 format as UAC1 at full speed
+		.bLength				= sizeof(struct usb_endpoint_descriptor),
+		.bDescriptorType		= USB_DTYPE_ENDPOINT,
+		.bEndpointAddress		= EP_IN,
+		.bmAttributes			= 0x11, // Isochronous feedback endpoint
+		.wMaxPacketSize			= 0x0003,
+		.bInterval				= FB_RATE + 1, // 2^(bInterval - 1) frames, same refresh as UAC1
+	},
+	
+#endif
 	.hid_interface = { // Standard HID Control interface descriptor
     	.bLength				= sizeof(struct usb_interface_descriptor),
     	.bDescriptorType		= USB_DTYPE_INTERFACE,
@@ -323,6 +856,11 @@ uint8_t get_current(usbd_device *dev, usbd_ctlreq *req);
 uint8_t get_max(usbd_device *dev, usbd_ctlreq *req);
 uint8_t get_min(usbd_device *dev, usbd_ctlreq *req);
 uint8_t get_res(usbd_device *dev, usbd_ctlreq *req);
+static uint8_t request_fs(int fs);
+static void hid_send(usbd_device *dev);
+#ifdef USB_UAC2
+static usbd_respond uac2_control(usbd_device *dev, usbd_ctlreq *req);
+#endif
 
 void SetFsLED(void) {
 	
@@ -343,6 +881,11 @@ void SetFsLED(void) {
 			GPIOB->BSRR |= GPIO_BSRR_BR6;
 			GPIOB->BSRR |= GPIO_BSRR_BR5;
 			break;
+		case 176400:
+			// Two LEDs have four states. 176.4 kHz shares the one of 88.2 kHz.
+			GPIOB->BSRR |= GPIO_BSRR_BS6;
+			GPIOB->BSRR |= GPIO_BSRR_BR5;
+			break;
 	}
 }
 
@@ -353,32 +896,62 @@ inline static uint32_t clamp(uint32_t val, uint32_t lower, uint32_t upper) {
 
 void reset_fb_data(AudioSettings audioSettings) {
 	
-	switch(audioSettings.sampling_frequency) {
-		case 44100:
-			fbData.fbDefault = (uint32_t) round(44.108 * 16384);
-			break;
-		case 48000:
-			fbData.fbDefault = (uint32_t) round(47.991 * 16384);
-			break;
-		case 88200:
-			fbData.fbDefault = (uint32_t) round(88.216 * 16384);
-			break;
-		case 96000:	
-			fbData.fbDefault = (uint32_t) round(95.982 * 16384);
-			break;
-		default:
-			;
-	}
+	fbData.fbDefault = AudioDefaultFeedback(audioSettings.sampling_frequency);
 	fbData.fbTx = 0;
 	fbData.sofNum = 0;
 	fbData.fb = fbData.fbDefault;
 	fbData.fbAcc = 0;
 	fbData.delta = 0;
 	fbData.rate = 1 << FB_RATE;
+	FeedbackInit(&fbPI, audioSettings.sampling_frequency, FB_LIMIT);
 }
 
 void OTG_FS_IRQHandler(void) {
+	PROFILE_ENTER();
+	PROFILE_SOF();
     usbd_poll(&udev);
+	PROFILE_EXIT(PROF_OTG);
+}
+
+// Sampling frequency switch, pended by set_current. Runs at the lowest
+// priority so that the busy waits for DMA, I2S and PLL do not hold off
+// the USB interrupt. Audio packets are dropped and feedback is paused
+// until pendingFs is cleared.
+void PendSV_Handler(void) {
+	
+	int		fs = pendingFs; // A new request may come in during the switch
+	
+	PROFILE_ENTER();
+	
+	if(!fs) {
+		PROFILE_EXIT(PROF_PENDSV);
+		return;
+	}
+	
+	AudioFadeOut(FADE_FRAMES(audioSettings.sampling_frequency));
+	DisableAudio();
+	AudioReconfigure(fs);
+	audioSettings.sampling_frequency = fs;
+	SetFsLED();
+	
+	// The host may change the alternate setting during the switch
+	__disable_irq();
+	PROFILE_MASK();
+	if(audioSettings.active)
+		EnableAudio();
+	audioSettings.playing = 0;
+	reset_fb_data(audioSettings);
+	AudioFadeIn(FADE_FRAMES(fs));
+	// Another rate was requested meanwhile and PendSV is pended again.
+	// Keep it until that run.
+	if(pendingFs == fs)
+		pendingFs = 0;
+#ifdef USB_UAC2
+	clockChanged = 1;
+#endif
+	PROFILE_UNMASK(PROF_MASKED);
+	__enable_irq();
+	PROFILE_EXIT(PROF_PENDSV);
 }
 
 //static USB_OTG_DeviceTypeDef * const OTGD = (void*)(USB_OTG_FS_PERIPH_BASE + USB_OTG_DEVICE_BASE);
@@ -391,7 +964,11 @@ static void send_feedback(usbd_device *dev, uint32_t fb, int correction) {
 	uint8_t		fbD[3];
 	
 	// Clamp feedback value to something appropriate 
-	fb = clamp(fb + correction, fbData.fbDefault - 1024, fbData.fbDefault + 1024);
+	fb += correction;
+	if(fb != clamp(fb, fbData.fbDefault - FB_LIMIT, fbData.fbDefault + FB_LIMIT)) {
+		fb = clamp(fb, fbData.fbDefault - FB_LIMIT, fbData.fbDefault + FB_LIMIT);
+		telemetry.fbClamps++;
+	}
 	
 	fbD[0] = fb & 0xff;
 	fbD[1] = (fb >> 8) & 0xff;
@@ -401,43 +978,54 @@ static void send_feedback(usbd_device *dev, uint32_t fb, int correction) {
 	(void) usbd_ep_write(dev, EP_IN, fbD, 3);
 }
 
+// Audio data is popped from the RX FIFO and written straight into the
+// ring buffer
+static uint16_t ept1_rx(volatile uint32_t *fifo, uint16_t len) {
+	
+	int		numSamples, frameBytes;
+	
+	// Packets are dropped while switching sampling frequency, and if they
+	// are larger than the alternate setting allows
+	if(pendingFs)
+		return 0;
+	if(len > altLimits[audioSettings.active].packet) {
+		telemetry.oversize++;
+		return 0;
+	}
+	frameBytes = audioSettings.bit_depth / 4;
+	
+	// The USB delivers packed 24-bit or 16-bit samples or 24-bit samples in
+	// 32-bit containers, 2 channels. Total 6, 4 or 8 bytes per sample
+	frameBytes = audioSettings.bit_depth / 4;
+	numSamples = len / frameBytes;
+	if((numSamples < audioSettings.sampling_frequency / 1000) || (len % frameBytes))
+		telemetry.shortPackets++;
+	if(audioSettings.mute) {
+		AudioWriteSilence(numSamples);
+		return 0;
+	}
+	if(frameBytes == 4)
+		AudioWrite16(fifo, numSamples);
+	else if(frameBytes == 8)
+		AudioWrite32(fifo, numSamples);
+	else
+		AudioWrite24(fifo, numSamples);
+	
+	return (numSamples * frameBytes + 3) / 4;
+}
+
 static void ept1_callback(usbd_device *dev, __attribute__((unused)) uint8_t event, uint8_t ep) {
 	
-	int			len, numSamples, i;
-	uint32_t	sampleR, sampleL;
+	int			len;
 	
 	if((ep == EP_OUT) && audioSettings.active) {
 	
 		usbd_toggle_sof(dev, EP_OUT);
-		len = usbd_ep_read(dev, ep, tmpBuf, EP_SIZE); // Returns number of bytes read
-		if(len <= EP_SIZE) {
-			
-			numSamples = len / 6; // 2 channels, 3 bytes in each. Total 6 bytes per sample
-			
-			for(i = 0; i < numSamples; ++i) {
-			
-				// The USB delivers 8 bit samples, so one audio sample consists of
-				// 3 USB samples
-				// Left first
-				sampleL = audioSettings.mute ? 0 : tmpBuf[i * 6] | 
-				                                   ((uint32_t)tmpBuf[i * 6 + 1] << 8) | 
-				                                   ((uint32_t)tmpBuf[i * 6 + 2] << 16);
-				sampleR = audioSettings.mute ? 0 : tmpBuf[i * 6 + 3] | 
-				                                   ((uint32_t)tmpBuf[i * 6 + 4] << 8) | 
-				                                   ((uint32_t)tmpBuf[i * 6 + 5] << 16);
+		len = usbd_ep_read_stream(dev, ep, ept1_rx); // Returns number of bytes read
+		if(len <= EP_SIZE16) {
 			
-				// The audio buffer consists of 16 bit samples
-				// The I2S interface is a 16-bit register, so needs to be loaded
-				// twice for samples larger than 16 bits. MSB first
-				audio_buffer[(4 * i + audio_status.writePtr) % BUF_SIZE] = (sampleL >> 8) & 0xffff;
-				audio_buffer[(4 * i + 1 + audio_status.writePtr) % BUF_SIZE] = (sampleL << 8) & 0xff00;
-				audio_buffer[(4 * i + 2 + audio_status.writePtr) % BUF_SIZE] = (sampleR >> 8) & 0xffff;
-				audio_buffer[(4 * i + 3 + audio_status.writePtr) % BUF_SIZE] = (sampleR << 8) & 0xff00;
-			}
-			audio_status.writePtr = (audio_status.writePtr + numSamples * 4) % BUF_SIZE;
-			
-			// Start playing after half the buffer is filled
-			if(!audioSettings.playing && (audio_status.writePtr >= BUF_SIZE/2)) {
+			// Start playing once the buffer is filled to the target level
+			if(!audioSettings.playing && !pendingFs && ((int)audio_status.written >= audio_status.target)) {
 				audioSettings.playing = 1;
 				SPI2->I2SCFGR |= SPI_I2SCFGR_I2SE;
 			}
@@ -457,29 +1045,42 @@ static void ept2_callback(__attribute__((unused)) usbd_device *dev,
 static void event_sof(usbd_device *dev, uint8_t event, 
                       __attribute__((unused)) uint8_t ep) {
 	
-	int			diff;
+	int			diff, bin;
 	
 	if(event == usbd_evt_sof) {
 		
 		//frame = usbd_getframe(dev);
+		
+		if(hidIdle && buttonEventPending())
+			hid_send(dev);
+		
+#ifdef USB_UAC2
+		if(clockChanged) {
+			clockChanged = 0;
+			usbd_ep_write(dev, AC_INT_EP, (void *)&clockInterrupt, sizeof(clockInterrupt));
+		}
+#endif
 	
-		if(audioSettings.active) {
+		if(audioSettings.active && !pendingFs) {
 		
-			audio_status.readPtr = BUF_SIZE - (DMA1_Stream4->NDTR & 0xffff);
 			if(audioSettings.playing)
-				diff = audio_status.writePtr > audio_status.readPtr ? 
-			           audio_status.writePtr - audio_status.readPtr :
-			           audio_status.writePtr - audio_status.readPtr + BUF_SIZE;
+				diff = AudioFill();
 			else
-				diff = BUF_SIZE / 2;
+				diff = audio_status.target;
+			audio_status.diff = diff;
+			
+			if(audioSettings.playing) {
+				bin = diff * FILL_BINS / audio_status.bufLen;
+				telemetry.fillHist[bin < 0 ? 0 : (bin >= FILL_BINS ? FILL_BINS - 1 : bin)]++;
+			}
 			
-			fbData.delta = (BUF_SIZE / 2 - diff) * 4;
-			// if diff < half the buffer size, the I2S consumes less data
+			fbData.delta = FeedbackUpdate(&fbPI, audio_status.target - diff);
+			// if diff < the target level, the I2S consumes less data
 			// than the USB interface provides. We need to report a lower 
 			// sampling frequency to the host
 			
 			// Feedback indicator LED
-			if(audioSettings.playing && (abs(diff - BUF_SIZE / 2) > 16))
+			if(audioSettings.playing && (abs(diff - audio_status.target) > FB_FILL_TOL))
 				GPIOC->BSRR |= GPIO_BSRR_BR13;
 			else
 				GPIOC->BSRR |= GPIO_BSRR_BS13;
@@ -502,8 +1103,10 @@ static void event_incompl(usbd_device *dev, uint8_t event,
 
 	switch(event) {
 		case usbd_evt_incomplOUT:
+			telemetry.incomplOut++;
 			break;
 		case usbd_evt_incomplIN:
+			telemetry.incomplIn++;
 			if(audioSettings.active && fbData.fbTx) {
 				usbd_flush_tx(dev, EP_IN & 0x7f);
 				send_feedback(dev, fbData.fb, fbData.delta);
@@ -517,15 +1120,17 @@ static void event_incompl(usbd_device *dev, uint8_t event,
 
 }
 
-/* HID IN endpoint callback */
-static void hid_eptIn(usbd_device *dev, __attribute__((unused)) uint8_t event, uint8_t ep) {
+// Usage bits for a button event. Play/pause and mute act on release, the
+// scan buttons also on a long press and then on every repeat.
+static uint8_t hid_usage(const struct button_event *e) {
 	
-	hid_report_data.buttons = 0;
+	const uint8_t	bit = 1 << (e->button - 1);
 	
-	switch(buttonReleased()) {
+	switch(e->button) {
 		case PLAY_BUTTON:
 			// Play/pause
-			hid_report_data.buttons |= 1;
+			if(e->type != BUTTON_RELEASE)
+				return 0;
 			if(playing) {
 				GPIOB->BSRR |= GPIO_BSRR_BR4;
 				playing = 0;
@@ -534,22 +1139,60 @@ static void hid_eptIn(usbd_device *dev, __attribute__((unused)) uint8_t event, u
 				GPIOB->BSRR |= GPIO_BSRR_BS4;
 				playing = 1;
 			}
-			break;
+			return 1;
 		case SCANFORWARD_BUTTON:
-			// Scan forward
-			hid_report_data.buttons |= 2;
-			break;
 		case SCANBACK_BUTTON:
-			// Scan backward
-			hid_report_data.buttons |= 4;
-			break;
+			// Scan forward or backward
+			if((e->type == BUTTON_LONG) || (e->type == BUTTON_REPEAT))
+				hidHeld |= bit;
+			else if(e->type != BUTTON_RELEASE)
+				return 0;
+			else if(hidHeld & bit) {
+				// Already scanned while held
+				hidHeld &= ~bit;
+				return 0;
+			}
+			return e->button == SCANFORWARD_BUTTON ? 2 : 4;
 		case MUTE_BUTTON:
 			// Mute
-			hid_report_data.buttons |= 8;
-			break;
+			return e->type == BUTTON_RELEASE ? 8 : 0;
+		default:
+			return 0;
 	}
+}
+
+// Queue the next HID report. A report with usages set is followed by an
+// empty one, then by the report for the next button event that has any.
+// The endpoint is left idle when there are no more events.
+static void hid_send(usbd_device *dev) {
+	
+	struct button_event	e;
+	
+	hidIdle = 0;
+	
+	if(!hid_report_data.buttons) {
+		while(buttonEvent(&e)) {
+			// Queued while the host was not polling
+			if(getUptime() - e.time > HID_EVENT_AGE)
+				continue;
+			if((hid_report_data.buttons = hid_usage(&e)))
+				break;
+		}
+		if(!hid_report_data.buttons) {
+			hidIdle = 1;
+			return;
+		}
+	}
+	else
+		hid_report_data.buttons = 0;
+	
+    usbd_ep_write(dev, HID_RIN_EP, &hid_report_data, sizeof(hid_report_data));
+}
 
-    usbd_ep_write(dev, ep, &hid_report_data, sizeof(hid_report_data));
+/* HID IN endpoint callback */
+static void hid_eptIn(usbd_device *dev, __attribute__((unused)) uint8_t event, __attribute__((unused)) uint8_t ep) {
+	
+	hid_send(dev);
 }
 
 /*
@@ -598,6 +1241,80 @@ static usbd_respond uac_getdesc(usbd_ctlreq *req, void **address, uint16_t *leng
 	return result;
 }
 
+/*
+Handle vendor requests
+*/
+static usbd_respond vendor_control(usbd_device *dev, usbd_ctlreq *req) {
+	
+	uint8_t		result = usbd_fail;
+	int			len;
+	const void	*data;
+	
+	switch(req->bRequest) {
+		case VENDOR_SET_LATENCY:
+			// Applied the next time streaming starts
+			if(AudioSetLatency(req->wValue))
+				result = usbd_ack;
+			break;
+		case VENDOR_GET_LATENCY:
+			((uint8_t *)dev->status.data_ptr)[0] = AudioGetLatency() & 0xff;
+			((uint8_t *)dev->status.data_ptr)[1] = AudioGetLatency() >> 8;
+			dev->status.data_count = 2;
+			result = usbd_ack;
+			break;
+		case VENDOR_SET_DITHER:
+			if(PCMSetDither(req->wValue))
+				result = usbd_ack;
+			break;
+		case VENDOR_GET_DITHER:
+			((uint8_t *)dev->status.data_ptr)[0] = (uint8_t)PCMGetDither();
+			dev->status.data_count = 1;
+			result = usbd_ack;
+			break;
+		case VENDOR_GET_PROFILE:
+			len = ProfileGet(req->wIndex, &data);
+			if(len) {
+				dev->status.data_ptr = (void *)data;
+				dev->status.data_count = len < req->wLength ? len : req->wLength;
+				result = usbd_ack;
+			}
+			break;
+		case VENDOR_GET_TELEMETRY:
+			// Copied so that the data stage is not changed by later SOFs
+			telemetrySnapshot = telemetry;
+			telemetrySnapshot.underruns = audio_status.underruns;
+			telemetrySnapshot.overruns = audio_status.overruns;
+			telemetrySnapshot.polls = dev->poll_stats.polls;
+			telemetrySnapshot.pollEvents = dev->poll_stats.events;
+			telemetrySnapshot.pollMax = dev->poll_stats.max;
+			dev->status.data_ptr = &telemetrySnapshot;
+			dev->status.data_count = sizeof(telemetrySnapshot) < req->wLength ? sizeof(telemetrySnapshot) : req->wLength;
+			result = usbd_ack;
+			break;
+		case VENDOR_RESET_TELEMETRY:
+			memset(&telemetry, 0, sizeof(telemetry));
+			audio_status.underruns = 0;
+			audio_status.overruns = 0;
+			memset(&dev->poll_stats, 0, sizeof(dev->poll_stats));
+			result = usbd_ack;
+			break;
+#ifdef ISR_PROFILE
+		case VENDOR_RESET_PROFILE:
+			ProfileReset();
+			result = usbd_ack;
+			break;
+		case VENDOR_PROFILE_BUS:
+			ProfileBusStart(req->wValue);
+			result = usbd_ack;
+			break;
+#endif
+		default:
+			;
+	}
+	
+	return result;
+}
+
 /*
 Handle CONTROL requests
 */
@@ -605,6 +1322,7 @@ static usbd_respond uac_control(usbd_device *dev, usbd_ctlreq *req,
                                 __attribute__((unused)) usbd_rqc_callback *callback) {
 	
 	uint8_t	result = usbd_fail;
+	int		fs = 0;
 	
 	if(((USB_REQ_RECIPIENT | USB_REQ_TYPE) & req->bmRequestType) == (USB_REQ_INTERFACE | USB_REQ_CLASS)) {
 		if(req->wIndex == 2) {
@@ -624,6 +1342,9 @@ static usbd_respond uac_control(usbd_device *dev, usbd_ctlreq *req,
 		}
 		else {
 			// Audio
+#ifdef USB_UAC2
+			result = uac2_control(dev, req);
+#else
 			switch(req->bRequest) {
 				case GET_CUR:
 					result = get_current(dev, req);
@@ -643,6 +1364,7 @@ static usbd_respond uac_control(usbd_device *dev, usbd_ctlreq *req,
 				default:
 					;
 			}
+#endif
 		}
 		
 	}
@@ -662,6 +1384,9 @@ static usbd_respond uac_control(usbd_device *dev, usbd_ctlreq *req,
 			}
 		}
 	}
+	else if(((USB_REQ_RECIPIENT | USB_REQ_TYPE) & req->bmRequestType) == (USB_REQ_DEVICE | USB_REQ_VENDOR)) {
+		result = vendor_control(dev, req);
+	}
 	else if(((USB_REQ_RECIPIENT | USB_REQ_TYPE) & req->bmRequestType) == (USB_REQ_INTERFACE | USB_REQ_STANDARD)) {
 		
 		if((req->wIndex == 2) && (req->bRequest == USB_STD_GET_DESCRIPTOR)) {
@@ -696,15 +1421,32 @@ static usbd_respond uac_control(usbd_device *dev, usbd_ctlreq *req,
 					break;
 				case USB_STD_SET_INTERFACE:
 					// wIndex is interface number, wValue the alternate setting number
-					if((req->wIndex == 1) && ((req->wValue == 0) || (req->wValue == 1))) {
+					if((req->wIndex == 1) && (req->wValue <= 3)) {
 						//usbd_ep_activate(dev, 1);
+						// PendSV_Handler enables audio when a switch is in progress
 						if(req->wValue == 0) {
-							DisableAudio();
+							if(!pendingFs)
+								DisableAudio();
 							GPIOB->BSRR |= GPIO_BSRR_BR4;
 							playing = 0;
 						}
-						else if(req->wValue == 1) {
-							EnableAudio();
+						else {
+							// The current rate, or the one being switched to, must fit
+							// the packets of the alternate setting
+							fs = pendingFs ? pendingFs : audioSettings.sampling_frequency;
+							if(fs > altLimits[req->wValue].maxFs) {
+#ifdef USB_UAC2
+								// The host selected the rate on the clock source
+								break;
+#else
+								// The host sets the rate of the endpoint after this
+								fs = altLimits[req->wValue].maxFs;
+#endif
+							}
+							// Alternate setting 1 is 24-bit, 2 is 16-bit, 3 is 32-bit
+							audioSettings.bit_depth = (req->wValue == 2) ? 16 : ((req->wValue == 3) ? 32 : 24);
+							if(!pendingFs)
+								EnableAudio();
 							GPIOB->BSRR |= GPIO_BSRR_BS4;
 							playing = 1;
 							//Test this: //send_feedback(dev, fbData.fb, 0);
@@ -714,6 +1456,8 @@ static usbd_respond uac_control(usbd_device *dev, usbd_ctlreq *req,
 						usbd_flush_rx(dev);
 						usbd_flush_tx(dev, EP_IN & 0x7f);
 						reset_fb_data(audioSettings);
+						if(fs && (fs != (pendingFs ? pendingFs : audioSettings.sampling_frequency)))
+							request_fs(fs);
 						
 						// Feedback indicator light reset
 						GPIOC->BSRR |= GPIO_BSRR_BS13;
@@ -747,13 +1491,17 @@ static usbd_respond uac_setconf(usbd_device *dev, uint8_t cfg) {
 			
 			usbd_ep_deconfig(dev, HID_RIN_EP);
         	usbd_reg_endpoint(dev, HID_RIN_EP, 0);
+        	hidIdle = 0;
+#ifdef USB_UAC2
+			usbd_ep_deconfig(dev, AC_INT_EP);
+#endif
 			
 			result = usbd_ack;
 			break;
 		case 1:
 			// Config
 			// Configure EP1 OUT
-    		res = usbd_ep_config(dev, EP_OUT, USB_EPTYPE_ISOCHRONOUS, EP_SIZE);
+    		res = usbd_ep_config(dev, EP_OUT, USB_EPTYPE_ISOCHRONOUS, EP_SIZE16); // Largest alternate setting
     		if(res)
     			usbd_reg_endpoint(dev, EP_OUT, ept1_callback);
     		
@@ -770,8 +1518,16 @@ static usbd_respond uac_setconf(usbd_device *dev, uint8_t cfg) {
     			res = usbd_ep_config(dev, HID_RIN_EP, USB_EPTYPE_INTERRUPT, HID_RIN_SZ);
     		if(res)
         		usbd_reg_endpoint(dev, HID_RIN_EP, hid_eptIn);
-        	if(res)
+        	if(res) {
+        		// Its completion starts sending button events
+        		hidIdle = 0;
+        		hid_report_data.buttons = 0;
         		usbd_ep_write(dev, HID_RIN_EP, 0, 0);
+        	}
+#ifdef USB_UAC2
+			if(res)
+				res = usbd_ep_config(dev, AC_INT_EP, USB_EPTYPE_INTERRUPT, AC_INT_SZ);
+#endif
     		
     		if(res)
 				result = usbd_ack;
@@ -783,6 +1539,54 @@ static usbd_respond uac_setconf(usbd_device *dev, uint8_t cfg) {
 	return result;
 }
 
+// Return a 16-bit little endian control value in the request buffer
+static uint8_t reply16(usbd_device *dev, int16_t value) {
+	
+	((uint8_t *)dev->status.data_ptr)[0] = value & 0xff;
+	((uint8_t *)dev->status.data_ptr)[1] = (value >> 8) & 0xff;
+	dev->status.data_count = 2;
+	
+	return usbd_ack;
+}
+
+static void set_mute(uint8_t mute) {
+	
+	audioSettings.mute = mute;
+	if(audioSettings.mute)
+		GPIOB->BSRR |= GPIO_BSRR_BS3;
+	else
+		GPIOB->BSRR |= GPIO_BSRR_BR3;
+}
+
+static void set_volume(int volume) {
+	
+	if(volume != VOLUME_SILENCE)
+		volume = volume < VOLUME_MIN ? VOLUME_MIN : (volume > VOLUME_MAX ? VOLUME_MAX : volume);
+	audioSettings.volume = volume;
+	AudioSetVolume(volume);
+}
+
+// Acknowledge a sampling frequency change now and switch in PendSV_Handler
+static uint8_t request_fs(int fs) {
+	
+	if((audioSettings.sampling_frequency == fs) && !pendingFs)
+		return usbd_ack;
+	
+	if(!AudioDefaultFeedback(fs))
+		return usbd_fail;
+	
+	// 24-bit packets above 96 kHz, 16-bit ones above 176.4 kHz and 32-bit
+	// ones above 48 kHz would exceed the full speed ISO packet or the
+	// bandwidth we reserve
+	if(audioSettings.active && (fs > altLimits[audioSettings.active].maxFs))
+		return usbd_fail;
+	
+	pendingFs = fs;
+	SCB->ICSR = SCB_ICSR_PENDSVSET_Msk;
+	
+	return usbd_ack;
+}
+
 uint8_t set_current(usbd_device *dev, usbd_ctlreq *req) {
 	
 	uint8_t		cs = (req->wValue >> 8) & 0xff;
@@ -793,11 +1597,12 @@ uint8_t set_current(usbd_device *dev, usbd_ctlreq *req) {
 		switch(cs) {
 			case 1:
 				// Mute
-				audioSettings.mute = req->data[0];
-				if(audioSettings.mute)
-					GPIOB->BSRR |= GPIO_BSRR_BS3;
-				else
-					GPIOB->BSRR |= GPIO_BSRR_BR3;
+				set_mute(req->data[0]);
+				result = usbd_ack;
+				break;
+			case 2:
+				// Volume
+				set_volume((int16_t)(req->data[0] | (req->data[1] << 8)));
 				result = usbd_ack;
 				break;
 			default:
@@ -811,16 +1616,7 @@ uint8_t set_current(usbd_device *dev, usbd_ctlreq *req) {
 				// Sampling frequency control
 				if(req->wIndex == 1) {
 					tmp = (req->data[0]) | (req->data[1] << 8) | (req->data[2] << 16);
-					if(audioSettings.sampling_frequency != tmp) {
-						audioSettings.sampling_frequency = tmp;
-						if(AudioReconfigure(audioSettings.sampling_frequency)) {
-							SetFsLED();
-							reset_fb_data(audioSettings);
-							result = usbd_ack;
-						}
-					}
-					else
-						result = usbd_ack;
+					result = request_fs(tmp);
 				}
 				else
 					usbd_ep_stall(dev, 0);
@@ -846,6 +1642,10 @@ uint8_t get_current(usbd_device *dev, usbd_ctlreq *req) {
 				dev->status.data_count = 1;
 				result = usbd_ack;
 				break;
+			case 2:
+				// Volume
+				result = reply16(dev, audioSettings.volume);
+				break;
 			default:
 				;
 		}
@@ -854,30 +1654,137 @@ uint8_t get_current(usbd_device *dev, usbd_ctlreq *req) {
 	return result;
 }
 
-uint8_t get_max(__attribute__((unused)) usbd_device *dev, 
-                __attribute__((unused)) usbd_ctlreq *req) {
+uint8_t get_max(usbd_device *dev, usbd_ctlreq *req) {
 	
 	int			result = usbd_fail;
+	
+	// Volume is the only feature unit control with a range
+	if((req->bmRequestType == 0xa1) && (((req->wValue >> 8) & 0xff) == 2))
+		result = reply16(dev, VOLUME_MAX);
 
 	return result;
 }
 
-uint8_t get_min(__attribute__((unused)) usbd_device *dev, 
-                __attribute__((unused)) usbd_ctlreq *req) {
+uint8_t get_min(usbd_device *dev, usbd_ctlreq *req) {
 	
 	int			result = usbd_fail;
+	
+	if((req->bmRequestType == 0xa1) && (((req->wValue >> 8) & 0xff) == 2))
+		result = reply16(dev, VOLUME_MIN);
 
 	return result;
 }
 
-uint8_t get_res(__attribute__((unused)) usbd_device *dev, 
-                __attribute__((unused)) usbd_ctlreq *req) {
+uint8_t get_res(usbd_device *dev, usbd_ctlreq *req) {
 	
 	int			result = usbd_fail;
+	
+	if((req->bmRequestType == 0xa1) && (((req->wValue >> 8) & 0xff) == 2))
+		result = reply16(dev, VOLUME_RES);
 
 	return result;
 }
 
+#ifdef USB_UAC2
+static const int	sampleRates[] = {44100, 48000, 88200, 96000, 176400};
+
+static int put16(uint8_t *buf, int value) {
+	
+	buf[0] = value & 0xff;
+	buf[1] = (value >> 8) & 0xff;
+	
+	return 2;
+}
+
+static int put32(uint8_t *buf, int value) {
+	
+	put16(buf, value);
+	put16(buf + 2, value >> 16);
+	
+	return 4;
+}
+
+// UAC2 CUR and RANGE requests to the clock source and the feature unit.
+// The entity is in the high byte of wIndex, the control selector in the
+// high byte of wValue.
+static usbd_respond uac2_control(usbd_device *dev, usbd_ctlreq *req) {
+	
+	uint8_t		entity = req->wIndex >> 8, cs = req->wValue >> 8;
+	uint8_t		*buf = dev->status.data_ptr;
+	int			get = req->bmRequestType & USB_REQ_DEVTOHOST, n = 0, i, max;
+	int			result = usbd_fail;
+	
+	if(entity == UAC2_CLOCK_ID) {
+		if((cs == USB_AUDIO2_CS_SAM_FREQ_CONTROL) && (req->bRequest == USB_AUDIO2_CUR)) {
+			if(get)
+				n = put32(buf, pendingFs ? pendingFs : audioSettings.sampling_frequency);
+			else
+				result = request_fs(req->data[0] | (req->data[1] << 8) | (req->data[2] << 16) | (req->data[3] << 24));
+		}
+		else if((cs == USB_AUDIO2_CS_SAM_FREQ_CONTROL) && (req->bRequest == USB_AUDIO2_RANGE) && get) {
+			// One discrete subrange per rate that the active alternate setting
+			// can carry. The clock source has one range for all of them, so
+			// before one is selected every rate is offered and SET_INTERFACE
+			// rejects a setting that is too small for the rate.
+			max = audioSettings.active ? altLimits[audioSettings.active].maxFs : 176400;
+			n = 2;
+			for(i = 0; i < (int)(sizeof(sampleRates) / sizeof(sampleRates[0])); ++i)
+				if(sampleRates[i] <= max) {
+					n += put32(buf + n, sampleRates[i]);
+					n += put32(buf + n, sampleRates[i]);
+					n += put32(buf + n, 0);
+				}
+			put16(buf, (n - 2) / 12);
+		}
+		else if((cs == USB_AUDIO2_CS_CLOCK_VALID_CONTROL) && (req->bRequest == USB_AUDIO2_CUR) && get) {
+			buf[0] = !pendingFs;
+			n = 1;
+		}
+	}
+	else if(entity == UAC2_FEATURE_ID) {
+		switch(cs) {
+			case USB_AUDIO_MUTE_CONTROL:
+				if(req->bRequest != USB_AUDIO2_CUR)
+					break;
+				if(get) {
+					buf[0] = audioSettings.mute;
+					n = 1;
+				}
+				else {
+					set_mute(req->data[0]);
+					result = usbd_ack;
+				}
+				break;
+			case USB_AUDIO_VOLUME_CONTROL:
+				if(req->bRequest == USB_AUDIO2_RANGE) {
+					if(get) {
+						n = put16(buf, 1);
+						n += put16(buf + n, VOLUME_MIN);
+						n += put16(buf + n, VOLUME_MAX);
+						n += put16(buf + n, VOLUME_RES);
+					}
+				}
+				else if(get)
+					n = put16(buf, audioSettings.volume);
+				else {
+					set_volume((int16_t)(req->data[0] | (req->data[1] << 8)));
+					result = usbd_ack;
+				}
+				break;
+			default:
+				;
+		}
+	}
+	
+	if(n) {
+		dev->status.data_count = n < req->wLength ? n : req->wLength;
+		result = usbd_ack;
+	}
+	
+	return result;
+}
+#endif
+
 void USBDeviceEnable(int enable) {
 	
 	usbd_connect(&udev, enable);
@@ -924,6 +1831,7 @@ void USBDeviceInit(void) {
 	audioSettings.sampling_frequency = 96000;
 	audioSettings.bit_depth = 24;
 	audioSettings.mute = 0;
+	audioSettings.volume = VOLUME_MAX;
 	audioSettings.playing = 0;
 	audioSettings.active = 0;
 	
@@ -940,7 +1848,6 @@ void USBDeviceInit(void) {
     usbd_reg_event(&udev, usbd_evt_incomplOUT, event_incompl);
     usbd_reg_event(&udev, usbd_evt_incomplIN, event_incompl);
     
-    NVIC_SetPriority(OTG_FS_IRQn, 1);
     NVIC_EnableIRQ(OTG_FS_IRQn);
     usbd_enable(&udev, true);
     usbd_connect(&udev, true);
@@ -7,6 +7,7 @@ typedef struct {
 	int			playing;
 	int			active;
 	uint8_t		mute;
+	int16_t		volume;		// 1/256 dB
 } AudioSettings;
 
 AudioSettings			audioSettings;
@@ -348,6 +348,7 @@ static void usbd_process_ep0 (usbd_device *dev, uint8_t event, uint8_t ep) {
  * \param ep active endpoint
  */
 static void usbd_process_evt(usbd_device *dev, uint8_t evt, uint8_t ep) {
+    dev->poll_stats.last++;
     switch (evt) {
     case usbd_evt_reset:
         usbd_process_reset(dev);
@@ -364,5 +365,11 @@ static void usbd_process_evt(usbd_device *dev, uint8_t evt, uint8_t ep) {
 }
 
  __attribute__((externally_visible)) void usbd_poll(usbd_device *dev) {
+    dev->poll_stats.last = 0;
     dev->driver->poll(dev, usbd_process_evt);
+    dev->poll_stats.polls++;
+    dev->poll_stats.events += dev->poll_stats.last;
+    if (dev->poll_stats.last > dev->poll_stats.max) {
+        dev->poll_stats.max = dev->poll_stats.last;
+    }
 }
@@ -37,6 +37,8 @@
 //#define USBD_SOF_OUT        /**<\brief Enables SOF output pin for F4 OTGFS. */
 //#define USBD_PRIMARY_OTGHS  /**<\brief Sets OTGHS as primary interface for F4*/
 //#define USBD_USE_EXT_ULPI   /**<\brief Enables external ULPI interface for OTGHS */
+//#define USBD_BATCH_POLL     /**<\brief Handles all pending events in one poll call for OTGFS driver. */
+//#define USBD_POLL_BUDGET    /**<\brief Maximum number of events handled in one batched poll call. */
 //#define USB_PMA_SIZE        /**<\brief PMA memoty size in bytes. Adjust this for the devices that shares PMA memory with CAN in case of both USB and CAN in use to avoid data corruption. */
 /** @} */
 #endif
@@ -169,6 +171,14 @@ typedef struct {
     uint8_t     control_state;  /**<\brief Current \ref usbd_ctl_state.*/
 } usbd_status;
 
+/** USB device event statistics.*/
+typedef struct {
+    uint32_t    polls;          /**<\brief Number of poll calls, i.e. USB interrupt entries.*/
+    uint32_t    events;         /**<\brief Total number of events handled.*/
+    uint8_t     last;           /**<\brief Events handled in the last poll call.*/
+    uint8_t     max;            /**<\brief Most events handled in one poll call.*/
+} usbd_poll_stats;
+
 /**\brief Generic USB device event callback for events and endpoints processing
   * \param[in] dev pointer to USB device
   * \param event \ref USB_EVENTS "USB event"
@@ -271,6 +281,21 @@ typedef void (*usbd_hw_ep_activate)(uint8_t ep);
  */
 typedef int32_t (*usbd_hw_ep_read)(uint8_t ep, void *buf, uint16_t blen);
 
+/**\brief Consumes an OUT packet straight from the RX FIFO
+ * \param fifo pointer to the RX FIFO. Every read pops the next 32-bit word.
+ * \param len packet length in bytes
+ * \return number of 32-bit words popped from the FIFO
+ * \note words not popped by the callback are discarded by the driver
+ */
+typedef uint16_t (*usbd_rx_stream_callback)(volatile uint32_t *fifo, uint16_t len);
+
+/**\brief Reads data from OUT endpoint by handing the RX FIFO to a callback
+ * \param ep endpoint index, should belong to OUT endpoint.
+ * \param callback callback that pops the packet data
+ * \return size of the received packet, -1 on error.
+ */
+typedef int32_t (*usbd_hw_ep_read_stream)(uint8_t ep, usbd_rx_stream_callback callback);
+
 /**\brief Writes data to IN or control endpoint
  * \param ep endpoint index, hould belong to IN or CONTROL endpoint
  * \param buf pointer to data buffer
@@ -324,6 +349,7 @@ struct usbd_driver {
     usbd_hw_ep_deconfig     ep_deconfig;        /**<\copybrief usbd_hw_ep_deconfig */
     usbd_hw_ep_activate		ep_activate;
     usbd_hw_ep_read         ep_read;            /**<\copybrief usbd_hw_ep_read */
+    usbd_hw_ep_read_stream  ep_read_stream;     /**<\copybrief usbd_hw_ep_read_stream */
     usbd_hw_ep_write        ep_write;           /**<\copybrief usbd_hw_ep_write */
     usbd_hw_ep_setstall     ep_setstall;        /**<\copybrief usbd_hw_ep_setstall */
     usbd_hw_ep_isstalled    ep_isstalled;       /**<\copybrief usbd_hw_ep_isstalled */
@@ -350,6 +376,7 @@ struct _usbd_device {
     usbd_evt_callback           events[usbd_evt_count]; /**<\brief array of the event callbacks.*/
     usbd_evt_callback           endpoint[8];            /**<\brief array of the endpoint callbacks.*/
     usbd_status                 status;                 /**<\copybrief usbd_status */
+    usbd_poll_stats             poll_stats;             /**<\copybrief usbd_poll_stats */
 };
 
 /**\brief Initializes device structure
@@ -456,6 +483,14 @@ inline static int32_t usbd_ep_read(usbd_device *dev, uint8_t ep, void *buf, uint
     return dev->driver->ep_read(ep, buf, blen);
 }
 
+/**\brief Read data from endpoint through a FIFO callback
+ * \param dev dev usb device \ref _usbd_device
+ * \copydetails usbd_hw_ep_read_stream
+ */
+inline static int32_t usbd_ep_read_stream(usbd_device *dev, uint8_t ep, usbd_rx_stream_callback callback) {
+    return dev->driver->ep_read_stream(ep, callback);
+}
+
 /**\brief Stall endpoint
  * \param dev dev usb device \ref _usbd_device
  * \param ep endpoint address
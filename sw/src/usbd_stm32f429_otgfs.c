@@ -29,7 +29,7 @@
 #if defined(USBD_STM32F429FS)
 
 #define MAX_EP          4
-#define MAX_RX_PACKET   582 //128
+#define MAX_RX_PACKET   708 // 16-bit stereo at 176.4 kHz, 177 frames
 #define MAX_CONTROL_EP  1
 #define MAX_FIFO_SZ     320  /*in 32-bit chunks */
 
@@ -37,6 +37,10 @@
 
 #define STATUS_VAL(x)   (USBD_HW_ADDRFST | (x))
 
+#if defined(USBD_BATCH_POLL) && !defined(USBD_POLL_BUDGET)
+#define USBD_POLL_BUDGET    16
+#endif
+
 static USB_OTG_GlobalTypeDef * const OTG  = (void*)(USB_OTG_FS_PERIPH_BASE + USB_OTG_GLOBAL_BASE);
 static USB_OTG_DeviceTypeDef * const OTGD = (void*)(USB_OTG_FS_PERIPH_BASE + USB_OTG_DEVICE_BASE);
 static volatile uint32_t * const OTGPCTL  = (void*)(USB_OTG_FS_PERIPH_BASE + USB_OTG_PCGCCTL_BASE);
@@ -363,6 +367,24 @@ static int32_t ep_read(uint8_t ep, void* buf, uint16_t blen) {
     return (len < blen) ? len : blen;
 }
 
+static int32_t ep_read_stream(uint8_t ep, usbd_rx_stream_callback callback) {
+    uint32_t len, words, used;
+    volatile uint32_t *fifo = EPFIFO(0);
+    /* no data in RX FIFO */
+    if (!(OTG->GINTSTS & USB_OTG_GINTSTS_RXFLVL)) return -1;
+    ep &= 0x7F;
+    if ((OTG->GRXSTSR & USB_OTG_GRXSTSP_EPNUM) != ep) return -1;
+    /* pop status and let the callback pop the data */
+    len = _FLD2VAL(USB_OTG_GRXSTSP_BCNT, OTG->GRXSTSP);
+    words = (len + 3) >> 2;
+    used = callback(fifo, len);
+    /* discard what the callback left in the fifo */
+    for (; used < words; used++) {
+        (void)*fifo;
+    }
+    return len;
+}
+
 static int32_t ep_write(uint8_t ep, void *buf, uint16_t blen) {
     uint32_t len, tmp;
     ep &= 0x7F;
@@ -429,9 +451,16 @@ static void toggle_sof(uint8_t ep_num) {
 	}
 }
 
+/* Without USBD_BATCH_POLL one event is handled per call and the interrupt
+ * is re-entered for the next one. With USBD_BATCH_POLL pending events are
+ * handled in the priority order below until none is left or
+ * USBD_POLL_BUDGET events have been handled. */
 static void evt_poll(usbd_device *dev, usbd_evt_callback callback) {
     uint32_t evt;
     uint32_t ep = 0;
+#if defined(USBD_BATCH_POLL)
+    uint32_t handled = 0;
+#endif
     while (1) {
         uint32_t _t = OTG->GINTSTS;
         /* bus RESET event */
@@ -509,7 +538,13 @@ static void evt_poll(usbd_device *dev, usbd_evt_callback callback) {
             /* no more supported events */
             return;
         }
+#if defined(USBD_BATCH_POLL)
+        callback(dev, evt, ep);
+        if (++handled >= USBD_POLL_BUDGET) return;
+        ep = 0;
+#else
         return callback(dev, evt, ep);
+#endif
     }
 }
 
@@ -548,6 +583,7 @@ static uint16_t get_serialno_desc(void *buffer) {
     ep_deconfig,
     ep_activate,
     ep_read,
+    ep_read_stream,
     ep_write,
     ep_setstall,
     ep_isstalled,
@@ -1,7 +1,7 @@
 #include "stm32f4xx.h"
 #include "utils.h"
 
-volatile uint32_t msTicks, ticks;
+volatile uint32_t msTicks, ticks, uptime;
 
 void SysTick_Handler(void)  {
 	
@@ -10,6 +10,8 @@ void SysTick_Handler(void)  {
 		
 	if(ticks != 0)
 		ticks--;
+	
+	uptime++;
 }
 
 void delay_ms(uint32_t ms) {
@@ -23,6 +25,12 @@ uint32_t getSysTicks(void) {
 	return ticks;
 }
 
+// Milliseconds since start
+uint32_t getUptime(void) {
+	
+	return uptime;
+}
+
 void setSysTicks(uint32_t newTicks) {
 	
 	ticks = newTicks;
@@ -1,3 +1,4 @@
 void delay_ms(uint32_t t);
 uint32_t getSysTicks(void);
-void setSysTicks(uint32_t newTicks);
\ No newline at end of file
+void setSysTicks(uint32_t newTicks);
+uint32_t getUptime(void);
\ No newline at end of file
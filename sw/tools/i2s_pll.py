@@ -0,0 +1,91 @@
+#!/usr/bin/env python3
+# Generates src/i2s_pll.h, the PLLI2S and I2S prescaler settings that give
+# the lowest sampling frequency error for each supported rate.
+#
+# Usage: i2s_pll.py HSE_FREQUENCY [RATE ...] > src/i2s_pll.h
+#
+# STM32F411 limits:
+#   PLLI2SM 2..63, VCO input HSE / M between 1 and 2 MHz
+#   PLLI2SN 50..432, VCO output between 100 and 432 MHz
+#   PLLI2SR 2..7, I2S clock at most 192 MHz
+#   I2SDIV 2..255, ODD 0 or 1
+# With the master clock output enabled, fs = I2S clock / (256 * (2 * I2SDIV + ODD)).
+# The 192 MHz limit and I2SDIV >= 2 put fs at most 187.5 kHz, so 192 kHz
+# cannot be generated with a 256 x fs master clock.
+
+import sys
+
+RATES = [44100, 48000, 88200, 96000, 176400]
+MAX_PPM = 500
+
+
+def search(hse, fs):
+    best = None
+    for m in range(2, 64):
+        vco_in = hse / m
+        if vco_in < 1e6 or vco_in > 2e6:
+            continue
+        for n in range(50, 433):
+            vco = vco_in * n
+            if vco < 100e6 or vco > 432e6:
+                continue
+            for r in range(2, 8):
+                i2sclk = vco / r
+                if i2sclk > 192e6:
+                    continue
+                d = round(i2sclk / (256 * fs))
+                if d < 4 or d > 511:
+                    continue
+                actual = i2sclk / (256 * d)
+                ppm = (actual - fs) / fs * 1e6
+                # Prefer lower error, then higher VCO input for lower jitter
+                key = (round(abs(ppm), 3), m)
+                if best is None or key < best[0]:
+                    best = (key, m, n, r, d >> 1, d & 1, actual, ppm)
+    return best[1:]
+
+
+def main():
+    if len(sys.argv) < 2:
+        sys.exit("usage: i2s_pll.py HSE_FREQUENCY [RATE ...]")
+    hse = int(sys.argv[1])
+    rates = [int(a) for a in sys.argv[2:]] or RATES
+
+    # Search all rates first so that a failure leaves no partial header
+    rows = []
+    for fs in rates:
+        m, n, r, div, odd, actual, ppm = search(hse, fs)
+        if abs(ppm) > MAX_PPM:
+            sys.exit("%d Hz: best setting is %.3f Hz, %+.1f ppm" % (fs, actual, ppm))
+        rows.append((fs, m, n, r, div, odd, round(actual / 1000 * 16384), actual, ppm))
+
+    print("// Generated by tools/i2s_pll.py for HSE = %d Hz. Do not edit." % hse)
+    print("#ifndef I2S_PLL_H_")
+    print("#define\tI2S_PLL_H_")
+    print()
+    print("#define I2S_PLL_HSE\t%d" % hse)
+    print()
+    print("#if defined(HSE_VALUE) && (HSE_VALUE != I2S_PLL_HSE)")
+    print("#error \"i2s_pll.h was generated for another HSE frequency, run make i2s_pll\"")
+    print("#endif")
+    print()
+    print("struct i2s_pll {")
+    print("\tint\t\t\tfs;\t\t// Nominal sampling frequency")
+    print("\tuint8_t\t\tm;\t\t// PLLI2SM")
+    print("\tuint16_t\tn;\t\t// PLLI2SN")
+    print("\tuint8_t\t\tr;\t\t// PLLI2SR")
+    print("\tuint8_t\t\tdiv;\t// I2SDIV")
+    print("\tuint8_t\t\todd;\t// I2SODD")
+    print("\tuint32_t\tfb;\t\t// Actual sampling frequency in kHz, 10.14 feedback format")
+    print("};")
+    print()
+    print("static const struct i2s_pll\ti2s_pll_table[] = {")
+    for row in rows:
+        print("\t{%d,\t%d,\t%d,\t%d,\t%d,\t%d,\t%d},\t// %.3f Hz, %+.1f ppm" % row)
+    print("};")
+    print()
+    print("#endif")
+
+
+if __name__ == "__main__":
+    main()